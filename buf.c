@@ -0,0 +1,169 @@
+/*
+ * ProFTPD - mod_conf_sql Buffer implementation
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+#include "buf.h"
+
+struct sqlconf_buf {
+  pool *pool;
+
+  /* The data is allocated from its own pool, so that the old data can be
+   * released when the buffer grows.
+   */
+  pool *data_pool;
+  char *data;
+  size_t datasz;
+  size_t datalen;
+
+  /* How much of the data has been read. */
+  size_t offset;
+};
+
+sqlconf_buf_t *sqlconf_buf_create(pool *p, size_t initsz) {
+  sqlconf_buf_t *buf;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (initsz == 0) {
+    initsz = 1024;
+  }
+
+  buf = pcalloc(p, sizeof(sqlconf_buf_t));
+  buf->pool = p;
+  buf->data_pool = make_sub_pool(p);
+  pr_pool_tag(buf->data_pool, "SQL Configuration Buffer Pool");
+  buf->datasz = initsz;
+  buf->data = palloc(buf->data_pool, buf->datasz);
+  buf->data[0] = '\0';
+
+  return buf;
+}
+
+static void buf_grow(sqlconf_buf_t *buf, size_t needed) {
+  size_t datasz;
+  pool *data_pool;
+  char *data;
+
+  datasz = buf->datasz;
+  while (datasz < needed) {
+    datasz *= 2;
+  }
+
+  /* Release the old data as soon as it is copied, so that the memory held
+   * is only ever the one block, however many times the buffer grows.
+   */
+  data_pool = make_sub_pool(buf->pool);
+  pr_pool_tag(data_pool, "SQL Configuration Buffer Pool");
+  data = palloc(data_pool, datasz);
+  memcpy(data, buf->data, buf->datalen + 1);
+  destroy_pool(buf->data_pool);
+
+  buf->data_pool = data_pool;
+  buf->data = data;
+  buf->datasz = datasz;
+}
+
+int sqlconf_buf_add(sqlconf_buf_t *buf, ...) {
+  va_list args;
+  const char *text;
+
+  if (buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  va_start(args, buf);
+  while ((text = va_arg(args, const char *)) != NULL) {
+    size_t textlen;
+
+    textlen = strlen(text);
+    if (buf->datalen + textlen + 1 > buf->datasz) {
+      buf_grow(buf, buf->datalen + textlen + 1);
+    }
+
+    memcpy(buf->data + buf->datalen, text, textlen);
+    buf->datalen += textlen;
+  }
+  va_end(args);
+
+  buf->data[buf->datalen] = '\0';
+  return 0;
+}
+
+int sqlconf_buf_read(sqlconf_buf_t *buf, char *dst, size_t dstsz) {
+  size_t len;
+
+  if (buf == NULL ||
+      dst == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  len = buf->datalen - buf->offset;
+  if (len > dstsz) {
+    len = dstsz;
+  }
+
+  memcpy(dst, buf->data + buf->offset, len);
+  buf->offset += len;
+
+  return (int) len;
+}
+
+int sqlconf_buf_clear(sqlconf_buf_t *buf) {
+  if (buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  buf->datalen = buf->offset = 0;
+  buf->data[0] = '\0';
+
+  return 0;
+}
+
+size_t sqlconf_buf_get_size(sqlconf_buf_t *buf) {
+  if (buf == NULL) {
+    errno = EINVAL;
+    return 0;
+  }
+
+  return buf->datasz;
+}
+
+const char *sqlconf_buf_get_text(sqlconf_buf_t *buf, size_t *textlen) {
+  if (buf == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (textlen != NULL) {
+    *textlen = buf->datalen;
+  }
+
+  return buf->data;
+}
@@ -0,0 +1,55 @@
+/*
+ * ProFTPD - mod_conf_sql Buffer API
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+
+#ifndef MOD_CONF_SQL_BUF_H
+#define MOD_CONF_SQL_BUF_H
+
+/* A growable, contiguous text buffer, with a read offset. */
+typedef struct sqlconf_buf sqlconf_buf_t;
+
+sqlconf_buf_t *sqlconf_buf_create(pool *p, size_t initsz);
+
+/* Appends the given NULL-terminated list of strings to the buffer, growing
+ * it as needed.
+ */
+int sqlconf_buf_add(sqlconf_buf_t *buf, ...);
+
+/* Copies as much of the unread text as fits into the given buffer, and
+ * advances the read offset past it.  Returns the number of bytes copied;
+ * zero means that all of the text has been read.
+ */
+int sqlconf_buf_read(sqlconf_buf_t *buf, char *dst, size_t dstsz);
+
+/* Discards all of the text in the buffer, keeping its memory for reuse. */
+int sqlconf_buf_clear(sqlconf_buf_t *buf);
+
+/* Returns the number of bytes allocated for the text of the buffer. */
+size_t sqlconf_buf_get_size(sqlconf_buf_t *buf);
+
+/* Returns the (NUL-terminated) text of the buffer, and its length. */
+const char *sqlconf_buf_get_text(sqlconf_buf_t *buf, size_t *textlen);
+
+#endif /* MOD_CONF_SQL_BUF_H */
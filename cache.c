@@ -0,0 +1,300 @@
+/*
+ * ProFTPD - mod_conf_sql Snapshot Cache implementation
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+#include "cache.h"
+
+/* A snapshot file looks like:
+ *
+ *   # mod_conf_sql snapshot 1
+ *   # generation: <generation>
+ *   # length: <length>
+ *   # hash: <hash>
+ *   <configuration text>
+ *
+ * The header lines are comments, so that a snapshot is itself a usable
+ * configuration file.
+ */
+#define CONF_SQL_CACHE_MAGIC		"# mod_conf_sql snapshot 1\n"
+#define CONF_SQL_CACHE_GENERATION	"# generation: "
+#define CONF_SQL_CACHE_LENGTH		"# length: "
+#define CONF_SQL_CACHE_HASH		"# hash: "
+
+/* Largest snapshot we are willing to read. */
+#define CONF_SQL_CACHE_MAX_SIZE		(256 * 1024 * 1024)
+
+static const char *trace_channel = "conf_sql";
+
+/* 64-bit FNV-1a; this guards against truncated/corrupted snapshots, not
+ * tampering.
+ */
+const char *sqlconf_cache_hash(pool *p, const char *data, size_t datalen) {
+  register size_t i;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  char hash[17];
+
+  for (i = 0; i < datalen; i++) {
+    h ^= (unsigned char) data[i];
+    h *= 0x100000001b3ULL;
+  }
+
+  memset(hash, '\0', sizeof(hash));
+  snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) h);
+  return pstrdup(p, hash);
+}
+
+static int cache_write_all(int fd, const char *data, size_t datalen) {
+  while (datalen > 0) {
+    ssize_t res;
+
+    res = write(fd, data, datalen);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return -1;
+    }
+
+    data += res;
+    datalen -= res;
+  }
+
+  return 0;
+}
+
+int sqlconf_cache_write(pool *p, const char *path, const char *generation,
+    const char *text, size_t textlen) {
+  int fd, xerrno;
+  char *header, *tmp_path, numbuf[64];
+
+  if (p == NULL ||
+      path == NULL ||
+      text == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* The generation must fit on its header line. */
+  if (generation == NULL) {
+    generation = "";
+  }
+
+  if (strchr(generation, '\n') != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(numbuf, '\0', sizeof(numbuf));
+  snprintf(numbuf, sizeof(numbuf)-1, "%lu", (unsigned long) textlen);
+
+  header = pstrcat(p, CONF_SQL_CACHE_MAGIC,
+    CONF_SQL_CACHE_GENERATION, generation, "\n",
+    CONF_SQL_CACHE_LENGTH, numbuf, "\n",
+    CONF_SQL_CACHE_HASH, sqlconf_cache_hash(p, text, textlen), "\n", NULL);
+
+  /* The snapshot is written by root, possibly in a directory others can
+   * write to, so the temporary file must be newly created, with a name that
+   * cannot be guessed, rather than opened wherever a (planted) link points.
+   */
+  tmp_path = pstrcat(p, path, ".XXXXXX", NULL);
+
+  fd = mkstemp(tmp_path);
+  if (fd < 0) {
+    xerrno = errno;
+
+    pr_trace_msg(trace_channel, 3, "error opening '%s': %s", tmp_path,
+      strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  if (fchmod(fd, 0600) < 0 ||
+      cache_write_all(fd, header, strlen(header)) < 0 ||
+      cache_write_all(fd, text, textlen) < 0 ||
+      fsync(fd) < 0) {
+    xerrno = errno;
+
+    pr_trace_msg(trace_channel, 3, "error writing '%s': %s", tmp_path,
+      strerror(xerrno));
+
+    (void) close(fd);
+    (void) unlink(tmp_path);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (close(fd) < 0) {
+    xerrno = errno;
+
+    (void) unlink(tmp_path);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (rename(tmp_path, path) < 0) {
+    xerrno = errno;
+
+    pr_trace_msg(trace_channel, 3, "error renaming '%s' to '%s': %s",
+      tmp_path, path, strerror(xerrno));
+
+    (void) unlink(tmp_path);
+    errno = xerrno;
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 9, "wrote %lu bytes to snapshot '%s'",
+    (unsigned long) textlen, path);
+  return 0;
+}
+
+/* Returns the value of the given header line, and advances the cursor past
+ * it; NULL if the next line is not that header.
+ */
+static char *cache_get_header(pool *p, char **cursor, const char *name) {
+  char *ptr, *eol;
+  size_t namelen;
+
+  ptr = *cursor;
+  namelen = strlen(name);
+
+  if (strncmp(ptr, name, namelen) != 0) {
+    return NULL;
+  }
+
+  eol = strchr(ptr, '\n');
+  if (eol == NULL) {
+    return NULL;
+  }
+
+  *cursor = eol + 1;
+  return pstrndup(p, ptr + namelen, eol - (ptr + namelen));
+}
+
+int sqlconf_cache_read(pool *p, const char *path, char **generation,
+    char **text, size_t *textlen) {
+  int fd, xerrno;
+  struct stat st;
+  char *data, *cursor, *gen, *len_text, *hash, *ptr = NULL;
+  size_t datalen = 0, magiclen;
+  unsigned long len;
+
+  if (p == NULL ||
+      path == NULL ||
+      text == NULL ||
+      textlen == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    xerrno = errno;
+
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (!S_ISREG(st.st_mode) ||
+      st.st_size > CONF_SQL_CACHE_MAX_SIZE) {
+    (void) close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  data = palloc(p, st.st_size + 1);
+  while (datalen < (size_t) st.st_size) {
+    ssize_t res;
+
+    res = read(fd, data + datalen, st.st_size - datalen);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      xerrno = errno;
+      (void) close(fd);
+      errno = xerrno;
+      return -1;
+    }
+
+    if (res == 0) {
+      break;
+    }
+
+    datalen += res;
+  }
+  data[datalen] = '\0';
+  (void) close(fd);
+
+  magiclen = strlen(CONF_SQL_CACHE_MAGIC);
+  if (datalen < magiclen ||
+      strncmp(data, CONF_SQL_CACHE_MAGIC, magiclen) != 0) {
+    pr_trace_msg(trace_channel, 3, "'%s' is not a snapshot", path);
+    errno = EINVAL;
+    return -1;
+  }
+
+  cursor = data + magiclen;
+
+  gen = cache_get_header(p, &cursor, CONF_SQL_CACHE_GENERATION);
+  len_text = gen ? cache_get_header(p, &cursor, CONF_SQL_CACHE_LENGTH) : NULL;
+  hash = len_text ? cache_get_header(p, &cursor, CONF_SQL_CACHE_HASH) : NULL;
+
+  if (hash == NULL) {
+    pr_trace_msg(trace_channel, 3, "snapshot '%s' has a malformed header",
+      path);
+    errno = EINVAL;
+    return -1;
+  }
+
+  len = strtoul(len_text, &ptr, 10);
+  if (ptr == NULL ||
+      *ptr != '\0' ||
+      len != (unsigned long) (datalen - (cursor - data))) {
+    pr_trace_msg(trace_channel, 3, "snapshot '%s' has the wrong length", path);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (strcmp(hash, sqlconf_cache_hash(p, cursor, len)) != 0) {
+    pr_trace_msg(trace_channel, 3, "snapshot '%s' has the wrong hash", path);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (generation != NULL) {
+    *generation = gen;
+  }
+
+  *text = cursor;
+  *textlen = len;
+  return 0;
+}
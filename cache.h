@@ -0,0 +1,48 @@
+/*
+ * ProFTPD - mod_conf_sql Snapshot Cache API
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+
+#ifndef MOD_CONF_SQL_CACHE_H
+#define MOD_CONF_SQL_CACHE_H
+
+/* Writes the given configuration text, and the generation of the database
+ * contents it was constructed from (if known), to the given snapshot file.
+ * The file is written to a temporary file first, then renamed into place,
+ * so that readers never see a partially written snapshot.
+ */
+int sqlconf_cache_write(pool *p, const char *path, const char *generation,
+  const char *text, size_t textlen);
+
+/* Reads the configuration text, and its generation, from the given snapshot
+ * file.  Returns -1 with ENOENT if there is no such file, or with EINVAL if
+ * the file is not a valid snapshot, e.g. truncated or corrupted.
+ */
+int sqlconf_cache_read(pool *p, const char *path, char **generation,
+  char **text, size_t *textlen);
+
+/* Returns the hash, as hex text, of the given data. */
+const char *sqlconf_cache_hash(pool *p, const char *data, size_t datalen);
+
+#endif /* MOD_CONF_SQL_CACHE_H */
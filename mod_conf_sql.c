@@ -32,6 +32,10 @@
 #include "mod_sql.h"
 #include "uri.h"
 #include "param.h"
+#include "tree.h"
+#include "buf.h"
+#include "cache.h"
+#include "workers.h"
 
 #define CONF_SQL_URI_SCHEME		"sql"
 #define CONF_SQL_URI_PREFIX		CONF_SQL_URI_SCHEME "://"
@@ -40,76 +44,307 @@
 /* Fake fd number for FSIO needs. */
 #define CONF_SQL_FILENO		2746
 
-struct {
-  const char *username;
-  const char *password;
-  const char *server;
-  const char *database;
+/* How the context tree is read from the database: one context at a time
+ * (the default), every context and directive at once, the base context's
+ * subtree via a recursive common table expression, or one level of the
+ * subtree at a time.
+ */
+#define CONF_SQL_STRATEGY_WALK		0
+#define CONF_SQL_STRATEGY_BULK		1
+#define CONF_SQL_STRATEGY_CTE		2
+#define CONF_SQL_STRATEGY_LEVEL		3
+
+/* Default number of workers used for "engine=async". */
+#define CONF_SQL_DEFAULT_ASYNC_WORKERS	8
+
+/* Default maximum context nesting followed beneath a base context. */
+#define CONF_SQL_DEFAULT_MAX_DEPTH	64
+
+/* Default number of context IDs per "IN (...)" list, for the level
+ * strategy.
+ */
+#define CONF_SQL_DEFAULT_BATCH_SIZE	256
+
+/* Maximum number of context IDs per "IN (...)" list, and of context rows per
+ * page.
+ */
+#define CONF_SQL_MAX_BATCH_SIZE		65536
+
+/* How long, in seconds, a revalidation helper may take, without
+ * deadline_ms.
+ */
+#define CONF_SQL_DEFAULT_REVALIDATE_SECS	60
+
+/* A query template, run once per context by the walk strategy; its prefix
+ * and suffix are built once per walk, and only the context ID, placed
+ * between them, varies between queries.
+ */
+typedef struct {
+  const char *name;
+  const char *prefix;
+  const char *suffix;
+
+} sqlconf_query_t;
+
+/* The state for loading, and reading, one sql:// "file".  Each open handle
+ * has its own, stored as the handle's fh_data, so that multiple sql:// URIs
+ * (e.g. via Include) can be loaded and read independently.
+ */
+typedef struct {
+  pool *pool;
+
+  /* Name of the mod_sql connection used by this handle. */
+  const char *conn_name;
+
+  struct {
+    const char *username;
+    const char *password;
+    const char *server;
+    const char *database;
+
+  } db;
+
+  struct {
+    const char *table;
+    const char *id_col;
+
+    const char *parent_id_col;
+    const char *type_col;
+    const char *value_col;
+
+    const char *where;
+
+    /* The IDs (char *) of the base contexts, in the order in which they are
+     * to be rendered; NULL for the default context.
+     */
+    array_header *base_ids;
+
+    /* The names (char *) of the base contexts, as listed, if given by name
+     * rather than by ID; resolved to base_ids once connected.
+     */
+    array_header *base_names;
+    const char *name_col;
+
+    /* Optional column holding the version of each context row. */
+    const char *version_col;
+
+  } ctxs;
+
+  struct {
+    const char *table;
+    const char *id_col;
+    const char *name_col;
+    const char *value_col;
+
+    const char *where;
+
+  } confs;
+
+  struct {
+    const char *table;
+    const char *conf_id_col;
+    const char *ctx_id_col;
+
+    const char *where;
+
+  } maps;
 
-} sqlconf_db;
+  int strategy;
+  unsigned int batch_size;
 
-struct {
-  const char *table;
-  const char *id_col;
+  /* Maximum number of context rows read per query by the bulk strategy;
+   * zero means all of them at once.
+   */
+  unsigned int page_size;
+
+  /* Whether the walk strategy generates the configuration text as it is
+   * read, rather than all at once when opened.
+   */
+  int lazy;
+
+  /* Maximum nesting of contexts followed beneath a base context. */
+  unsigned int max_depth;
+
+  /* Whether a lazy walk reads the next context, using a worker process,
+   * while the parser reads the text of the current one.
+   */
+  int prefetch;
+  sqlconf_workers_t *prefetch_workers;
+
+  /* The context being read by the prefetch worker, if any. */
+  int prefetch_id;
+  int prefetch_pending;
+
+  /* Number of worker processes among which the walk strategy divides the
+   * child contexts of each base context; zero (or one) means none.
+   */
+  unsigned int workers;
+
+  /* The constructed configuration text, and how much of it has been read. */
+  sqlconf_buf_t *conf;
+
+  /* When walking the whole configuration one context at a time, the
+   * directives for every context are read up front, using a single query,
+   * and kept here, grouped by context ID.
+   */
+  sqlconf_tree_t *conf_tree;
 
-  const char *parent_id_col;
-  const char *type_col;
-  const char *value_col;
+  sqlconf_query_t *ctx_query;
+  sqlconf_query_t *ctx_ctxs_query;
+  sqlconf_query_t *conf_query;
 
-  const char *where;
-  const char *base_id;
+  /* The frames of a lazy walk in progress (see below). */
+  array_header *frames;
 
-} sqlconf_ctxs;
+  /* The URI from which this handle was opened. */
+  const char *uri;
 
-struct {
-  const char *table;
-  const char *id_col;
-  const char *name_col;
-  const char *value_col;
+  /* Path of the snapshot file of the constructed configuration, if any. */
+  const char *cache_path;
 
-  const char *where;
+  /* How long, in milliseconds, reading the configuration from the database
+   * may take before the snapshot is used instead; zero means no limit.
+   */
+  unsigned int deadline_ms;
+
+  /* Whether the snapshot is used right away, while a helper process reads
+   * the database in the background; and whether that helper then signals
+   * a restart, if the configuration changed.
+   */
+  int revalidate;
+  int revalidate_hup;
 
-} sqlconf_confs;
+  /* The query used to read the generation of the database contents, if
+   * configured.
+   */
+  const char *generation_query;
 
-struct {
-  const char *table;
-  const char *conf_id_col;
-  const char *ctx_id_col;
+  /* Generation of the database contents the configuration was constructed
+   * from, if known.
+   */
+  const char *generation;
 
-  const char *where;
+  /* Set when the configuration was reused, rather than constructed anew,
+   * because the generation was unchanged.
+   */
+  int unchanged;
 
-} sqlconf_maps;
+} sqlconf_handle_t;
 
 module conf_sql_module;
 pool *conf_sql_pool = NULL;
 
-static array_header *sqlconf_conf = NULL;
-static unsigned int sqlconf_confi = 0;
+/* A database connection.  Connections are kept open until the end of the
+ * parse, so that every sql:// URI using the same database (e.g. via Include)
+ * shares one connection, rather than connecting anew.
+ */
+struct sqlconf_conn {
+  const char *name;
+  const char *driver;
+  int opened;
+};
+
+/* The connections of the current parse, keyed by driver, server, database,
+ * and user, and the drivers prepared for them; all are allocated from
+ * sqlconf_conns_pool, which is destroyed once the parse is done.
+ */
+static pool *sqlconf_conns_pool = NULL;
+static pr_table_t *sqlconf_conns = NULL;
+static array_header *sqlconf_conn_list = NULL;
+static array_header *sqlconf_drivers = NULL;
+
+/* The names of the connections are made from this prefix; a revalidation
+ * helper (see sqlconf_revalidate()) uses its own.
+ */
+static const char *sqlconf_conn_prefix = "sqlconf";
+
+/* The trees read in full, by the bulk strategy, during the current parse,
+ * keyed by connection and table set (see sqlconf_get_memo_key()), so that
+ * later sql:// URIs for the same tables, e.g. for other base contexts, need
+ * not read them again.
+ */
+static pool *sqlconf_memo_pool = NULL;
+static pr_table_t *sqlconf_memos = NULL;
+
+/* The last configuration constructed for each URI, and its generation, kept
+ * across restarts so that an unchanged configuration need not be read from
+ * the database again.
+ */
+struct sqlconf_generation {
+  pool *pool;
+  const char *generation;
+  const char *text;
+  size_t textlen;
+};
+
+static pr_table_t *sqlconf_generations = NULL;
+
+/* The revalidation helper last started for each snapshot, kept across
+ * restarts, so that another is not started for the same snapshot while it
+ * is still running.
+ */
+struct sqlconf_revalidation {
+  pid_t pid;
+};
+
+static pr_table_t *sqlconf_revalidations = NULL;
 
-/* This pool is a sub-pool of the module pool, and is used for the info in
- * the sqlconf_conf array header.
+/* The deadline for reading the configuration currently being opened, if any
+ * (see deadline_ms).  The configuration is read by a helper process, which
+ * is abandoned once the deadline passes (see sqlconf_read_db_deadline());
+ * every query the helper makes, including those made by its worker
+ * processes, is also checked against it.
  */
-static pool *sqlconf_conf_pool = NULL;
+struct sqlconf_deadline {
+  int active;
+  struct timeval expires;
+
+  /* The driver of the database being read, for driver-specific statement
+   * timeouts.
+   */
+  const char *driver;
+
+  /* Set once a query has been refused, or has finished, past the deadline;
+   * the configuration read is then incomplete.
+   */
+  int expired;
+
+  /* The connection's previous statement timeout, to be restored, if it was
+   * changed.
+   */
+  const char *conn_name;
+  const char *prev_stmt_timeout;
+};
+
+static struct sqlconf_deadline sqlconf_deadline;
 
 static int use_tracing = FALSE;
 
 static const char *trace_channel = "conf_sql";
 
 /* Prototypes */
-static int sqlconf_read_ctx(pool *p, int ctx_id, int isbase);
+static int sqlconf_read_ctx(sqlconf_handle_t *h, pool *p, int ctx_id,
+  int isbase, int base_id);
+static int sqlconf_define_conn(sqlconf_handle_t *h, pool *p,
+  const char *conn_name);
+static int sqlconf_open_conn(pool *p, const char *conn_name);
+static const char *sqlconf_set_stmt_timeout(pool *p, const char *conn_name,
+  const char *timeout);
 static void sqlconf_register(pool *p);
 
-static int sqlconf_parse_ctx_param(pool *p, pr_table_t *params) {
+static int sqlconf_parse_ctx_param(sqlconf_handle_t *h, pool *p,
+    pr_table_t *params) {
   int res;
   char *table, *id_col, *parent_id_col, *type_col, *value_col, *where;
 
   /* Defaults */
-  sqlconf_ctxs.table = CONF_SQL_CTX_DEFAULT_TABLE_NAME;
-  sqlconf_ctxs.id_col = CONF_SQL_CTX_DEFAULT_ID_COL_NAME;
-  sqlconf_ctxs.parent_id_col = CONF_SQL_CTX_DEFAULT_PARENT_ID_COL_NAME;
-  sqlconf_ctxs.type_col = CONF_SQL_CTX_DEFAULT_TYPE_COL_NAME;
-  sqlconf_ctxs.value_col = CONF_SQL_CTX_DEFAULT_VALUE_COL_NAME;
-  sqlconf_ctxs.where = NULL;
+  h->ctxs.table = CONF_SQL_CTX_DEFAULT_TABLE_NAME;
+  h->ctxs.id_col = CONF_SQL_CTX_DEFAULT_ID_COL_NAME;
+  h->ctxs.parent_id_col = CONF_SQL_CTX_DEFAULT_PARENT_ID_COL_NAME;
+  h->ctxs.type_col = CONF_SQL_CTX_DEFAULT_TYPE_COL_NAME;
+  h->ctxs.value_col = CONF_SQL_CTX_DEFAULT_VALUE_COL_NAME;
+  h->ctxs.name_col = CONF_SQL_CTX_DEFAULT_NAME_COL_NAME;
+  h->ctxs.where = NULL;
 
   table = id_col = parent_id_col = type_col = value_col = where = NULL;
 
@@ -120,42 +355,43 @@ static int sqlconf_parse_ctx_param(pool *p, pr_table_t *params) {
   }
 
   if (table != NULL) {
-    sqlconf_ctxs.table = table;
+    h->ctxs.table = table;
   }
 
   if (id_col != NULL) {
-    sqlconf_ctxs.id_col = id_col;
+    h->ctxs.id_col = id_col;
   }
 
   if (parent_id_col != NULL) {
-    sqlconf_ctxs.parent_id_col = parent_id_col;
+    h->ctxs.parent_id_col = parent_id_col;
   }
 
   if (type_col != NULL) {
-    sqlconf_ctxs.type_col = type_col;
+    h->ctxs.type_col = type_col;
   }
 
   if (value_col != NULL) {
-    sqlconf_ctxs.value_col = value_col;
+    h->ctxs.value_col = value_col;
   }
 
   if (where != NULL) {
-    sqlconf_ctxs.where = where;
+    h->ctxs.where = where;
   }
 
   return 0;
 }
 
-static int sqlconf_parse_conf_param(pool *p, pr_table_t *params) {
+static int sqlconf_parse_conf_param(sqlconf_handle_t *h, pool *p,
+    pr_table_t *params) {
   int res;
   char *table, *id_col, *name_col, *value_col, *where;
 
   /* Defaults */
-  sqlconf_confs.table = CONF_SQL_CONF_DEFAULT_TABLE_NAME;
-  sqlconf_confs.id_col = CONF_SQL_CONF_DEFAULT_ID_COL_NAME;
-  sqlconf_confs.name_col = CONF_SQL_CONF_DEFAULT_NAME_COL_NAME;
-  sqlconf_confs.value_col = CONF_SQL_CONF_DEFAULT_VALUE_COL_NAME;
-  sqlconf_confs.where = NULL;
+  h->confs.table = CONF_SQL_CONF_DEFAULT_TABLE_NAME;
+  h->confs.id_col = CONF_SQL_CONF_DEFAULT_ID_COL_NAME;
+  h->confs.name_col = CONF_SQL_CONF_DEFAULT_NAME_COL_NAME;
+  h->confs.value_col = CONF_SQL_CONF_DEFAULT_VALUE_COL_NAME;
+  h->confs.where = NULL;
 
   table = id_col = name_col = value_col = where = NULL;
 
@@ -166,37 +402,38 @@ static int sqlconf_parse_conf_param(pool *p, pr_table_t *params) {
   }
 
   if (table != NULL) {
-    sqlconf_confs.table = table;
+    h->confs.table = table;
   }
 
   if (id_col != NULL) {
-    sqlconf_confs.id_col = id_col;
+    h->confs.id_col = id_col;
   }
 
   if (name_col != NULL) {
-    sqlconf_confs.name_col = name_col;
+    h->confs.name_col = name_col;
   }
 
   if (value_col != NULL) {
-    sqlconf_confs.value_col = value_col;
+    h->confs.value_col = value_col;
   }
 
   if (where != NULL) {
-    sqlconf_confs.where = where;
+    h->confs.where = where;
   }
 
   return 0;
 }
 
-static int sqlconf_parse_map_param(pool *p, pr_table_t *params) {
+static int sqlconf_parse_map_param(sqlconf_handle_t *h, pool *p,
+    pr_table_t *params) {
   int res;
   char *table, *conf_id_col, *ctx_id_col, *where;
 
   /* Defaults */
-  sqlconf_maps.table = CONF_SQL_MAP_DEFAULT_TABLE_NAME;
-  sqlconf_maps.conf_id_col = CONF_SQL_MAP_DEFAULT_CONF_ID_COL_NAME;
-  sqlconf_maps.ctx_id_col = CONF_SQL_MAP_DEFAULT_CTX_ID_COL_NAME;
-  sqlconf_maps.where = NULL;
+  h->maps.table = CONF_SQL_MAP_DEFAULT_TABLE_NAME;
+  h->maps.conf_id_col = CONF_SQL_MAP_DEFAULT_CONF_ID_COL_NAME;
+  h->maps.ctx_id_col = CONF_SQL_MAP_DEFAULT_CTX_ID_COL_NAME;
+  h->maps.where = NULL;
 
   table = conf_id_col = ctx_id_col = where = NULL;
 
@@ -207,19 +444,51 @@ static int sqlconf_parse_map_param(pool *p, pr_table_t *params) {
   }
 
   if (table != NULL) {
-    sqlconf_maps.table = table;
+    h->maps.table = table;
   }
 
   if (conf_id_col != NULL) {
-    sqlconf_maps.conf_id_col = conf_id_col;
+    h->maps.conf_id_col = conf_id_col;
   }
 
   if (ctx_id_col != NULL) {
-    sqlconf_maps.ctx_id_col = ctx_id_col;
+    h->maps.ctx_id_col = ctx_id_col;
   }
 
   if (where != NULL) {
-    sqlconf_maps.where = where;
+    h->maps.where = where;
+  }
+
+  return 0;
+}
+
+static int sqlconf_parse_generation_param(sqlconf_handle_t *h, pool *p,
+    pr_table_t *params) {
+  int res;
+  char *type, *table, *col;
+
+  h->generation_query = NULL;
+
+  type = table = col = NULL;
+
+  res = sqlconf_param_parse_generation(p, params, &type, &table, &col);
+  if (res < 0) {
+    return -1;
+  }
+
+  if (type == NULL) {
+    return 0;
+  }
+
+  /* Note that mod_sql prepends "SELECT " to these queries. */
+  if (strcmp(type, "table") == 0) {
+    h->generation_query = pstrcat(p, col, " FROM ", table, NULL);
+
+  } else {
+    h->generation_query = pstrcat(p,
+      "(SELECT MAX(", col, ") FROM ", h->ctxs.table, "), ",
+      "(SELECT MAX(", col, ") FROM ", h->confs.table, "), ",
+      "(SELECT MAX(", col, ") FROM ", h->maps.table, ")", NULL);
   }
 
   return 0;
@@ -232,10 +501,24 @@ static int sqlconf_parse_map_param(pool *p, pr_table_t *params) {
  *   &ctx:<table>[:id,parent_id,key,value][:where=<clause>]\
  *   &conf:<table>[:id,key,value][:where=<clause>]\
  *   &map:<table>[:conf_id,ctx_id][:where=<clause>]\
- *   [&base_id=<name>]
+ *   [&base_id=<id>[,<id>|<first>-<last>...]]\
+ *   [&base_name=<name>[*][,<name>[*]...]]\
+ *   [&strategy=walk|bulk|cte|level]\
+ *   [&batch_size=<count>]\
+ *   [&page_size=<count>]\
+ *   [&lazy=<boolean>]\
+ *   [&max_depth=<count>]\
+ *   [&prefetch=<boolean>]\
+ *   [&workers=<count>]\
+ *   [&engine=sync|async]\
+ *   [&version=<column>]\
+ *   [&cache=<path>]\
+ *   [&deadline_ms=<count>]\
+ *   [&revalidate=<boolean>|hup]\
+ *   [&generation=table:<table>[:<column>]|max:<column>]
  */
-static int sqlconf_parse_uri(pool *p, const char *uri, char **driver,
-    int *tracing) {
+static int sqlconf_parse_uri(sqlconf_handle_t *h, pool *p, const char *uri,
+    char **driver, int *tracing) {
   int res, xerrno;
   char *host = NULL, *path = NULL, *username, *password;
   unsigned int port = 0;
@@ -263,25 +546,25 @@ static int sqlconf_parse_uri(pool *p, const char *uri, char **driver,
 
     memset(portnum, '\0', sizeof(portnum));
     snprintf(portnum, sizeof(portnum)-1, "%u", port);
-    sqlconf_db.server = pstrcat(p, host, ":", portnum, NULL);
+    h->db.server = pstrcat(p, host, ":", portnum, NULL);
 
   } else {
-    sqlconf_db.server = pstrdup(p, host);
+    h->db.server = pstrdup(p, host);
   }
 
-  sqlconf_db.username = pstrdup(p, username);
-  sqlconf_db.password = pstrdup(p, password);
+  h->db.username = pstrdup(p, username);
+  h->db.password = pstrdup(p, password);
 
   /* Advance one character past the path separator to get the database/schema
    * name.
    */
   if (path != NULL) {
-    sqlconf_db.database = pstrdup(p, path + 1);
+    h->db.database = pstrdup(p, path + 1);
   }
 
   v = pr_table_get(params, "database", NULL);
   if (v != NULL) {
-    sqlconf_db.database = v;
+    h->db.database = v;
   }
 
   v = pr_table_get(params, "tracing", NULL);
@@ -297,13 +580,13 @@ static int sqlconf_parse_uri(pool *p, const char *uri, char **driver,
   }
 
   pr_trace_msg(trace_channel, 6, "db.username = %s",
-    sqlconf_db.username ? sqlconf_db.username : "(none)");
+    h->db.username ? h->db.username : "(none)");
   pr_trace_msg(trace_channel, 6, "db.server = %s",
-    sqlconf_db.server ? sqlconf_db.server : "(none)");
+    h->db.server ? h->db.server : "(none)");
   pr_trace_msg(trace_channel, 6, "db.database = %s",
-    sqlconf_db.database ? sqlconf_db.database : "(none)");
+    h->db.database ? h->db.database : "(none)");
 
-  if (sqlconf_parse_ctx_param(p, params) < 0) {
+  if (sqlconf_parse_ctx_param(h, p, params) < 0) {
     xerrno = errno;
 
     pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
@@ -314,16 +597,16 @@ static int sqlconf_parse_uri(pool *p, const char *uri, char **driver,
     return -1;
   }
 
-  pr_trace_msg(trace_channel, 6, "ctx.table = %s", sqlconf_ctxs.table);
-  pr_trace_msg(trace_channel, 6, "ctx.id_col = %s", sqlconf_ctxs.id_col);
+  pr_trace_msg(trace_channel, 6, "ctx.table = %s", h->ctxs.table);
+  pr_trace_msg(trace_channel, 6, "ctx.id_col = %s", h->ctxs.id_col);
   pr_trace_msg(trace_channel, 6, "ctx.parent_id_col = %s",
-    sqlconf_ctxs.parent_id_col);
-  pr_trace_msg(trace_channel, 6, "ctx.type_col = %s", sqlconf_ctxs.type_col);
-  pr_trace_msg(trace_channel, 6, "ctx.value_col = %s", sqlconf_ctxs.value_col);
+    h->ctxs.parent_id_col);
+  pr_trace_msg(trace_channel, 6, "ctx.type_col = %s", h->ctxs.type_col);
+  pr_trace_msg(trace_channel, 6, "ctx.value_col = %s", h->ctxs.value_col);
   pr_trace_msg(trace_channel, 6, "ctx.where = %s",
-    sqlconf_ctxs.where ? sqlconf_ctxs.where : "(none)");
+    h->ctxs.where ? h->ctxs.where : "(none)");
 
-  if (sqlconf_parse_conf_param(p, params) < 0) {
+  if (sqlconf_parse_conf_param(h, p, params) < 0) {
     xerrno = errno;
 
     pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
@@ -334,15 +617,15 @@ static int sqlconf_parse_uri(pool *p, const char *uri, char **driver,
     return -1;
   }
 
-  pr_trace_msg(trace_channel, 6, "conf.table = %s", sqlconf_confs.table);
-  pr_trace_msg(trace_channel, 6, "conf.id_col = %s", sqlconf_confs.id_col);
-  pr_trace_msg(trace_channel, 6, "conf.name_col = %s", sqlconf_confs.name_col);
+  pr_trace_msg(trace_channel, 6, "conf.table = %s", h->confs.table);
+  pr_trace_msg(trace_channel, 6, "conf.id_col = %s", h->confs.id_col);
+  pr_trace_msg(trace_channel, 6, "conf.name_col = %s", h->confs.name_col);
   pr_trace_msg(trace_channel, 6, "conf.value_col = %s",
-    sqlconf_confs.value_col);
+    h->confs.value_col);
   pr_trace_msg(trace_channel, 6, "conf.where = %s",
-    sqlconf_confs.where ? sqlconf_confs.where : "(none)");
+    h->confs.where ? h->confs.where : "(none)");
 
-  if (sqlconf_parse_map_param(p, params) < 0) {
+  if (sqlconf_parse_map_param(h, p, params) < 0) {
     xerrno = errno;
 
     pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
@@ -353,21 +636,351 @@ static int sqlconf_parse_uri(pool *p, const char *uri, char **driver,
     return -1;
   }
 
-  pr_trace_msg(trace_channel, 6, "map.table = %s", sqlconf_maps.table);
+  pr_trace_msg(trace_channel, 6, "map.table = %s", h->maps.table);
   pr_trace_msg(trace_channel, 6, "map.conf_id_col = %s",
-    sqlconf_maps.conf_id_col);
+    h->maps.conf_id_col);
   pr_trace_msg(trace_channel, 6, "map.ctx_id_col = %s",
-    sqlconf_maps.ctx_id_col);
+    h->maps.ctx_id_col);
   pr_trace_msg(trace_channel, 6, "map.where = %s",
-    sqlconf_maps.where ? sqlconf_maps.where : "(none)");
+    h->maps.where ? h->maps.where : "(none)");
+
+  if (sqlconf_param_parse_base_ids(p, params, &(h->ctxs.base_ids)) < 0) {
+    xerrno = errno;
+
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": failed parsing base_id portion of URI '%.100s': %s", uri,
+      strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
 
   v = pr_table_get(params, "base_id", NULL);
+  pr_trace_msg(trace_channel, 6, "ctxs.base_id = %s (%u IDs)",
+    v ? (char *) v : "(none)",
+    h->ctxs.base_ids ? h->ctxs.base_ids->nelts : 0);
+
+  if (sqlconf_param_parse_base_names(p, params, &(h->ctxs.base_names)) < 0) {
+    xerrno = errno;
+
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": failed parsing base_name portion of URI '%.100s': %s", uri,
+      strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  if (h->ctxs.base_names != NULL &&
+      h->ctxs.base_ids != NULL) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": URI '%.100s' cannot use both base_id and base_name", uri);
+    errno = EINVAL;
+    return -1;
+  }
+
+  v = pr_table_get(params, "base_name", NULL);
+  pr_trace_msg(trace_channel, 6, "ctxs.base_name = %s",
+    v ? (char *) v : "(none)");
+
+  h->strategy = CONF_SQL_STRATEGY_WALK;
+
+  v = pr_table_get(params, "strategy", NULL);
+  if (v != NULL) {
+    if (strcasecmp(v, "walk") == 0) {
+      h->strategy = CONF_SQL_STRATEGY_WALK;
+
+    } else if (strcasecmp(v, "bulk") == 0) {
+      h->strategy = CONF_SQL_STRATEGY_BULK;
+
+    } else if (strcasecmp(v, "cte") == 0) {
+      h->strategy = CONF_SQL_STRATEGY_CTE;
+
+    } else if (strcasecmp(v, "level") == 0) {
+      h->strategy = CONF_SQL_STRATEGY_LEVEL;
+
+    } else {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": unsupported strategy '%s' in URI '%.100s'", (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  pr_trace_msg(trace_channel, 6, "strategy = %s",
+    h->strategy == CONF_SQL_STRATEGY_BULK ? "bulk" :
+    h->strategy == CONF_SQL_STRATEGY_CTE ? "cte" :
+    h->strategy == CONF_SQL_STRATEGY_LEVEL ? "level" : "walk");
+
+  h->batch_size = CONF_SQL_DEFAULT_BATCH_SIZE;
+
+  v = pr_table_get(params, "batch_size", NULL);
+  if (v != NULL) {
+    char *ptr = NULL;
+    long batch_size;
+
+    batch_size = strtol(v, &ptr, 10);
+    if (ptr == NULL ||
+        *ptr != '\0' ||
+        batch_size <= 0 ||
+        batch_size > CONF_SQL_MAX_BATCH_SIZE) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": invalid batch_size '%s' in URI '%.100s'", (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+
+    h->batch_size = (unsigned int) batch_size;
+  }
+
+  pr_trace_msg(trace_channel, 6, "batch_size = %u", h->batch_size);
+
+  h->page_size = 0;
+
+  v = pr_table_get(params, "page_size", NULL);
+  if (v != NULL) {
+    char *ptr = NULL;
+    long page_size;
+
+    page_size = strtol(v, &ptr, 10);
+    if (ptr == NULL ||
+        *ptr != '\0' ||
+        page_size < 0 ||
+        page_size > CONF_SQL_MAX_BATCH_SIZE) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": invalid page_size '%s' in URI '%.100s'", (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+
+    h->page_size = (unsigned int) page_size;
+  }
+
+  pr_trace_msg(trace_channel, 6, "page_size = %u", h->page_size);
+
+  h->lazy = FALSE;
+
+  v = pr_table_get(params, "lazy", NULL);
+  if (v != NULL) {
+    res = pr_str_is_boolean(v);
+    if (res == TRUE) {
+      if (h->strategy == CONF_SQL_STRATEGY_WALK) {
+        h->lazy = TRUE;
+
+      } else {
+        pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+          ": lazy generation only supported by the walk strategy, ignoring");
+      }
+    }
+  }
+
+  pr_trace_msg(trace_channel, 6, "lazy = %s", h->lazy ? "true" : "false");
+
+  h->max_depth = CONF_SQL_DEFAULT_MAX_DEPTH;
+
+  v = pr_table_get(params, "max_depth", NULL);
+  if (v != NULL) {
+    char *ptr = NULL;
+    long max_depth;
+
+    max_depth = strtol(v, &ptr, 10);
+    if (ptr == NULL ||
+        *ptr != '\0' ||
+        max_depth < 0 ||
+        max_depth > INT_MAX) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": invalid max_depth '%s' in URI '%.100s'", (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+
+    h->max_depth = (unsigned int) max_depth;
+  }
+
+  pr_trace_msg(trace_channel, 6, "max_depth = %u", h->max_depth);
+
+  h->prefetch = FALSE;
+
+  v = pr_table_get(params, "prefetch", NULL);
+  if (v != NULL) {
+    res = pr_str_is_boolean(v);
+    if (res == TRUE) {
+      if (h->lazy == TRUE) {
+        h->prefetch = TRUE;
+
+      } else {
+        pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+          ": prefetch only supported for lazy generation, ignoring");
+      }
+    }
+  }
+
+  pr_trace_msg(trace_channel, 6, "prefetch = %s",
+    h->prefetch ? "true" : "false");
+
+  h->workers = 0;
+
+  v = pr_table_get(params, "workers", NULL);
+  if (v != NULL) {
+    char *ptr = NULL;
+    long workers;
+
+    workers = strtol(v, &ptr, 10);
+    if (ptr == NULL ||
+        *ptr != '\0' ||
+        workers < 0 ||
+        workers > CONF_SQL_WORKERS_MAX_COUNT) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": invalid workers '%s' in URI '%.100s'", (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (h->strategy == CONF_SQL_STRATEGY_WALK &&
+        h->lazy == FALSE) {
+      h->workers = (unsigned int) workers;
+
+    } else {
+      pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+        ": workers only supported by the non-lazy walk strategy, ignoring");
+    }
+  }
+
+  pr_trace_msg(trace_channel, 6, "workers = %u", h->workers);
+
+  /* "engine=async" asks for several queries in flight at once, across
+   * several connections, which is what the workers already do; it is thus
+   * the same as "workers", with a default count of workers.
+   */
+  v = pr_table_get(params, "engine", NULL);
+  if (v != NULL) {
+    if (strcasecmp(v, "async") == 0) {
+      if (h->strategy == CONF_SQL_STRATEGY_WALK &&
+          h->lazy == FALSE) {
+        if (h->workers <= 1) {
+          h->workers = CONF_SQL_DEFAULT_ASYNC_WORKERS;
+        }
+
+        pr_trace_msg(trace_channel, 6,
+          "engine = async, using workers = %u", h->workers);
+
+      } else {
+        pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+          ": async engine only supported by the non-lazy walk strategy, "
+          "ignoring");
+      }
+
+    } else if (strcasecmp(v, "sync") != 0) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": unsupported engine '%s' in URI '%.100s'", (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  v = pr_table_get(params, "version", NULL);
   if (v != NULL) {
-    sqlconf_ctxs.base_id = v;
+    if (h->strategy != CONF_SQL_STRATEGY_WALK) {
+      h->ctxs.version_col = v;
+
+    } else {
+      pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+        ": context versions not supported by the walk strategy, ignoring");
+    }
+  }
+
+  pr_trace_msg(trace_channel, 6, "ctx.version_col = %s",
+    h->ctxs.version_col ? h->ctxs.version_col : "(none)");
+
+  v = pr_table_get(params, "cache", NULL);
+  if (v != NULL) {
+    if (*((char *) v) != '/') {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": cache path '%s' in URI '%.100s' is not an absolute path",
+        (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+
+    h->cache_path = v;
+  }
+
+  pr_trace_msg(trace_channel, 6, "cache = %s",
+    h->cache_path ? h->cache_path : "(none)");
+
+  h->deadline_ms = 0;
+
+  v = pr_table_get(params, "deadline_ms", NULL);
+  if (v != NULL) {
+    char *ptr = NULL;
+    long deadline_ms;
+
+    deadline_ms = strtol(v, &ptr, 10);
+    if (ptr == NULL ||
+        *ptr != '\0' ||
+        deadline_ms < 0 ||
+        deadline_ms > INT_MAX) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": invalid deadline_ms '%s' in URI '%.100s'", (char *) v, uri);
+      errno = EINVAL;
+      return -1;
+    }
+
+    /* A lazily generated configuration is parsed as it is read, so there is
+     * no point at which it could still be swapped for the snapshot.
+     */
+    if (h->lazy == FALSE) {
+      h->deadline_ms = (unsigned int) deadline_ms;
+
+    } else {
+      pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+        ": deadline_ms not supported for lazy generation, ignoring");
+    }
+  }
+
+  pr_trace_msg(trace_channel, 6, "deadline_ms = %u", h->deadline_ms);
+
+  h->revalidate = h->revalidate_hup = FALSE;
+
+  v = pr_table_get(params, "revalidate", NULL);
+  if (v != NULL) {
+    if (strcasecmp(v, "hup") == 0) {
+      h->revalidate = h->revalidate_hup = TRUE;
+
+    } else {
+      res = pr_str_is_boolean(v);
+      if (res == TRUE) {
+        h->revalidate = TRUE;
+      }
+    }
+
+    if (h->revalidate == TRUE) {
+      if (h->cache_path == NULL ||
+          h->lazy == TRUE) {
+        pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+          ": revalidate requires a cache snapshot, and is not supported for "
+          "lazy generation, ignoring");
+        h->revalidate = h->revalidate_hup = FALSE;
+      }
+    }
+  }
+
+  pr_trace_msg(trace_channel, 6, "revalidate = %s",
+    h->revalidate ? (h->revalidate_hup ? "hup" : "true") : "false");
+
+  if (sqlconf_parse_generation_param(h, p, params) < 0) {
+    xerrno = errno;
+
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": failed parsing generation portion of URI '%.100s': %s", uri,
+      strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
   }
 
-  pr_trace_msg(trace_channel, 6, "ctxs.base_id = %s",
-    sqlconf_ctxs.base_id ? sqlconf_ctxs.base_id : "(none)");
+  pr_trace_msg(trace_channel, 6, "generation query = %s",
+    h->generation_query ? h->generation_query : "(none)");
 
   /* Look for a specific database backend/driver to use. */
   v = pr_table_get(params, "driver", NULL);
@@ -410,9 +1023,33 @@ static cmd_rec *sqlconf_cmd_alloc(pool *p, unsigned int argc, ...) {
   return cmd;
 }
 
+/* Returns the number of milliseconds left before the deadline, if any;
+ * zero or less means the deadline has passed.
+ */
+static long sqlconf_deadline_remaining(void) {
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return ((sqlconf_deadline.expires.tv_sec - now.tv_sec) * 1000L) +
+    ((sqlconf_deadline.expires.tv_usec - now.tv_usec) / 1000L);
+}
+
+static void sqlconf_expire_deadline(void) {
+  if (sqlconf_deadline.expired == FALSE) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": deadline passed, refusing further queries");
+    sqlconf_deadline.expired = TRUE;
+  }
+}
+
+static int sqlconf_is_driver(const char *driver, const char *name) {
+  return driver != NULL && strcasecmp(driver, name) == 0;
+}
+
 static modret_t *sqlconf_dispatch(cmd_rec *cmd, char *name) {
   cmdtable *cmdtab;
   modret_t *res;
+  int is_query;
 
   cmdtab = pr_stash_get_symbol(PR_SYM_HOOK, name, NULL, NULL);
   if (cmdtab == NULL) {
@@ -421,7 +1058,50 @@ static modret_t *sqlconf_dispatch(cmd_rec *cmd, char *name) {
     return PR_ERROR(cmd);
   }
 
+  is_query = (strcmp(name, "sql_select") == 0 ||
+    strcmp(name, "sql_open_conn") == 0);
+
+  if (sqlconf_deadline.active == TRUE &&
+      is_query == TRUE) {
+    long remaining;
+
+    remaining = sqlconf_deadline_remaining();
+    if (remaining <= 0) {
+      sqlconf_expire_deadline();
+      errno = ETIMEDOUT;
+      return PR_ERROR_MSG(cmd, MOD_CONF_SQL_VERSION, "deadline passed");
+    }
+
+    /* MySQL (5.7.8 and later) takes a statement timeout as an optimizer
+     * hint, which must directly follow the SELECT keyword that mod_sql adds,
+     * i.e. precede either the raw query or the list of columns.  Other
+     * databases would ignore it as a comment.
+     */
+    if (cmd->argc >= 2 &&
+        strcmp(name, "sql_select") == 0 &&
+        sqlconf_is_driver(sqlconf_deadline.driver, "mysql") == TRUE) {
+      unsigned int idx;
+      char hint[64];
+
+      idx = (cmd->argc == 2 ? 1 : 2);
+
+      memset(hint, '\0', sizeof(hint));
+      snprintf(hint, sizeof(hint)-1, "/*+ MAX_EXECUTION_TIME(%ld) */ ",
+        remaining);
+      cmd->argv[idx] = pstrcat(cmd->pool, hint, cmd->argv[idx], NULL);
+    }
+  }
+
   res = pr_module_call(cmdtab->m, cmdtab->handler, cmd);
+
+  /* A query which finished past the deadline may have been cut short by a
+   * statement timeout.
+   */
+  if (sqlconf_deadline.active == TRUE &&
+      is_query == TRUE &&
+      sqlconf_deadline_remaining() <= 0) {
+    sqlconf_expire_deadline();
+  }
   if (MODRET_ISERROR(res)) {
     pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION ": '%s' error: %s", name,
       res->mr_message);
@@ -431,33 +1111,91 @@ static modret_t *sqlconf_dispatch(cmd_rec *cmd, char *name) {
   return res;
 }
 
-/* Database-reading routines
+/* Note: these are not server-side prepared statements.  mod_sql does not
+ * expose a hook for preparing or executing one (its sql_select hook always
+ * prepends "SELECT "), so each query is still sent as text, and parsed and
+ * planned by the database; only the building of the query text, apart from
+ * the context ID, is done once.
  */
+static sqlconf_query_t *sqlconf_make_query(pool *p, const char *name,
+    const char *prefix, const char *suffix) {
+  sqlconf_query_t *query;
+
+  query = pcalloc(p, sizeof(sqlconf_query_t));
+  query->name = pstrdup(p, name);
+  query->prefix = pstrdup(p, prefix);
+  query->suffix = pstrdup(p, suffix ? suffix : "");
+
+  pr_trace_msg(trace_channel, 9, "'%s' query template: SELECT %s?%s",
+    query->name, query->prefix, query->suffix);
+  return query;
+}
 
-static int sqlconf_read_ctx_ctxs(pool *p, int ctx_id) {
-  cmd_rec *cmd = NULL;
-  modret_t *res = NULL;
-  sql_data_t *sd = NULL;
-  char *where = NULL;
-
-  register unsigned int i = 0;
+/* The query text, the command, and the result are all allocated from
+ * the given pool; callers use a scratch pool, destroyed as soon as the rows
+ * have been consumed, so that the memory used while loading does not grow
+ * with the number of queries run.
+ */
+static modret_t *sqlconf_dispatch_query(sqlconf_handle_t *h, pool *p,
+    sqlconf_query_t *query, int id) {
+  cmd_rec *cmd;
   char idstr[64] = {'\0'};
 
-  snprintf(idstr, sizeof(idstr)-1, "%d", ctx_id);
+  snprintf(idstr, sizeof(idstr)-1, "%d", id);
   idstr[sizeof(idstr)-1] = '\0';
 
-  if (sqlconf_ctxs.where == NULL) {
-    where = pstrcat(p, sqlconf_ctxs.parent_id_col, " = ", idstr, NULL);
+  cmd = sqlconf_cmd_alloc(p, 2, h->conn_name, pstrcat(p, query->prefix,
+    idstr, query->suffix, NULL));
+  return sqlconf_dispatch(cmd, "sql_select");
+}
 
-  } else {
-    where = pstrcat(p, sqlconf_ctxs.parent_id_col, " = ", idstr, " AND ",
-      sqlconf_ctxs.where, NULL);
+/* Database-reading routines
+ */
+
+/* Build the per-context query templates used by the walk strategy. */
+static void sqlconf_make_walk_queries(sqlconf_handle_t *h, pool *p) {
+  const char *ctxs_where = "", *confs_where = "";
+
+  if (h->ctxs.where != NULL) {
+    ctxs_where = pstrcat(p, " AND ", h->ctxs.where, NULL);
+  }
+
+  if (h->confs.where != NULL) {
+    confs_where = pstrcat(p, " AND ", h->confs.where, NULL);
   }
 
-  cmd = sqlconf_cmd_alloc(p, 4, "sqlconf", sqlconf_ctxs.table,
-    sqlconf_ctxs.id_col, where);
+  h->ctx_query = sqlconf_make_query(p, "ctx",
+    pstrcat(p, h->ctxs.type_col, ", ", h->ctxs.value_col, " FROM ",
+      h->ctxs.table, " WHERE ", h->ctxs.id_col, " = ", NULL),
+    ctxs_where);
+
+  h->ctx_ctxs_query = sqlconf_make_query(p, "ctx_ctxs",
+    pstrcat(p, h->ctxs.id_col, " FROM ", h->ctxs.table, " WHERE ",
+      h->ctxs.parent_id_col, " = ", NULL), ctxs_where);
+
+  h->conf_query = sqlconf_make_query(p, "conf",
+    pstrcat(p, h->confs.name_col, ", ", h->confs.value_col,
+      " FROM ", h->confs.table, " INNER JOIN ", h->maps.table,
+      " ON ", h->confs.table, ".", h->confs.id_col, " = ",
+      h->maps.table, ".", h->maps.conf_id_col, " WHERE ",
+      h->maps.table, ".", h->maps.ctx_id_col, " = ", NULL),
+    confs_where);
+}
 
-  res = sqlconf_dispatch(cmd, "sql_select");
+/* Returns the IDs (int) of the child contexts of the given context. */
+static array_header *sqlconf_get_ctx_ctxs(sqlconf_handle_t *h, pool *p,
+    int ctx_id) {
+  modret_t *res = NULL;
+  sql_data_t *sd = NULL;
+  array_header *ids;
+  pool *tmp_pool;
+
+  register unsigned int i = 0;
+
+  tmp_pool = make_sub_pool(p);
+  pr_pool_tag(tmp_pool, "SQL Configuration Query Pool");
+
+  res = sqlconf_dispatch_query(h, tmp_pool, h->ctx_ctxs_query, ctx_id);
   if (MODRET_ISERROR(res)) {
     int xerrno = errno;
     const char *errmsg;
@@ -466,50 +1204,44 @@ static int sqlconf_read_ctx_ctxs(pool *p, int ctx_id) {
     pr_trace_msg(trace_channel, 9, "SQL SELECT error: %s",
       errmsg ? errmsg : "(unknown)");
 
+    destroy_pool(tmp_pool);
     errno = xerrno;
-    return -1;
+    return NULL;
   }
 
   sd = res->data;
 
+  ids = make_array(p, sd->rnum > 0 ? sd->rnum : 1, sizeof(int));
   for (i = 0; i < sd->rnum; i++) {
-    sqlconf_read_ctx(p, atoi(sd->data[i]), FALSE);
+    *((int *) push_array(ids)) = atoi(sd->data[i]);
   }
 
-  return 0;
+  destroy_pool(tmp_pool);
+  return ids;
 }
 
-static int sqlconf_read_conf(pool *p, int ctx_id) {
-  cmd_rec *cmd = NULL;
+static int sqlconf_read_conf(sqlconf_handle_t *h, pool *p, int ctx_id) {
   modret_t *res = NULL;
   sql_data_t *sd = NULL;
-  char *query = NULL;
+  pool *tmp_pool;
 
   register unsigned int i = 0;
-  char idstr[64] = {'\0'};
 
-  snprintf(idstr, sizeof(idstr)-1, "%d", ctx_id);
-  idstr[sizeof(idstr)-1] = '\0';
+  if (h->conf_tree != NULL) {
+    char idstr[64] = {'\0'};
 
-  if (sqlconf_confs.where == NULL) {
-    query = pstrcat(p, sqlconf_confs.name_col, ", ", sqlconf_confs.value_col,
-      " FROM ", sqlconf_confs.table, " INNER JOIN ", sqlconf_maps.table,
-      " ON ", sqlconf_confs.table, ".", sqlconf_confs.id_col, " = ",
-      sqlconf_maps.table, ".", sqlconf_maps.conf_id_col, " WHERE ",
-      sqlconf_maps.table, ".", sqlconf_maps.ctx_id_col, " = ", idstr, NULL);
+    snprintf(idstr, sizeof(idstr)-1, "%d", ctx_id);
+    idstr[sizeof(idstr)-1] = '\0';
 
-  } else {
-    query = pstrcat(p, sqlconf_confs.name_col, ", ", sqlconf_confs.value_col,
-      " FROM ", sqlconf_confs.table, " INNER JOIN ", sqlconf_maps.table,
-      " ON ", sqlconf_confs.table, ".", sqlconf_confs.id_col, " = ",
-      sqlconf_maps.table, ".", sqlconf_maps.conf_id_col, " WHERE ",
-      sqlconf_maps.table, ".", sqlconf_maps.ctx_id_col, " = ", idstr,
-      " AND ", sqlconf_confs.where, NULL);
+    /* A context without directives is fine. */
+    (void) sqlconf_tree_render_confs(h->conf_tree, idstr, h->conf);
+    return 0;
   }
 
-  cmd = sqlconf_cmd_alloc(p, 2, "sqlconf", query);
+  tmp_pool = make_sub_pool(p);
+  pr_pool_tag(tmp_pool, "SQL Configuration Query Pool");
 
-  res = sqlconf_dispatch(cmd, "sql_select");
+  res = sqlconf_dispatch_query(h, tmp_pool, h->conf_query, ctx_id);
   if (MODRET_ISERROR(res)) {
     int xerrno = errno;
     const char *errmsg;
@@ -518,6 +1250,7 @@ static int sqlconf_read_conf(pool *p, int ctx_id) {
     pr_trace_msg(trace_channel, 9, "SQL SELECT error: %s",
       errmsg ? errmsg : "(unknown)");
 
+    destroy_pool(tmp_pool);
     errno = xerrno;
     return -1;
   }
@@ -525,317 +1258,3247 @@ static int sqlconf_read_conf(pool *p, int ctx_id) {
   sd = res->data;
 
   for (i = 0; i < sd->rnum; i++) {
-    char *str;
-
-    str = pstrcat(sqlconf_conf_pool, sd->data[(i * sd->fnum)], " ",
+    sqlconf_buf_add(h->conf, sd->data[(i * sd->fnum)], " ",
       sd->data[(i * sd->fnum) + 1], "\n", NULL);
-    *((char **) push_array(sqlconf_conf)) = str;
   }
 
+  destroy_pool(tmp_pool);
   return 0;
 }
 
-static int sqlconf_read_ctx(pool *p, int ctx_id, int isbase) {
-  cmd_rec *cmd = NULL;
+/* Emits the opening tag (unless this is the base context) and the
+ * directives of the given context; the context's type, needed for the
+ * closing tag, is returned via ctx_type, allocated from the given pool.
+ */
+static int sqlconf_open_ctx(sqlconf_handle_t *h, pool *p, int ctx_id,
+    int isbase, char **ctx_type) {
   modret_t *res = NULL;
   sql_data_t *sd = NULL;
-  char *where = NULL;
+  pool *tmp_pool;
 
-  char idstr[64] = {'\0'};
   char *ctx_key = NULL, *ctx_val = NULL;
 
-  snprintf(idstr, sizeof(idstr)-1, "%d", ctx_id);
-  idstr[sizeof(idstr)-1] = '\0';
+  tmp_pool = make_sub_pool(p);
+  pr_pool_tag(tmp_pool, "SQL Configuration Query Pool");
+
+  res = sqlconf_dispatch_query(h, tmp_pool, h->ctx_query, ctx_id);
+  if (MODRET_ISERROR(res)) {
+    pr_log_debug(DEBUG4, MOD_CONF_SQL_VERSION
+      ": notice: context ID (%d) has no associated key/value", ctx_id);
+    destroy_pool(tmp_pool);
+    errno = ENOENT;
+    return -1;
+  }
+
+  sd = res->data;
+
+  if (sd->rnum > 1) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error: multiple key/values returned for given context ID (%d)",
+      ctx_id);
+    destroy_pool(tmp_pool);
+    errno = EINVAL;
+    return -1;
+  }
+
+  ctx_key = sd->data[0];
+  if (sd->fnum > 1) {
+    size_t len;
+
+    ctx_val = sd->data[1];
+    len = strlen(ctx_val);
+    if (len == 0) {
+      ctx_val = NULL;
+    }
+  }
+
+  if (ctx_key != NULL &&
+      !isbase) {
+    sqlconf_buf_add(h->conf, "<", ctx_key, ctx_val ? " " : "",
+      ctx_val ? ctx_val : "", ">\n", NULL);
+  }
+
+  *ctx_type = ctx_key != NULL ? pstrdup(p, ctx_key) : NULL;
+  destroy_pool(tmp_pool);
+
+  if (sqlconf_read_conf(h, p, ctx_id) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Walking with workers: the base contexts, or the child contexts of a single
+ * base context, are handed out to worker processes, each with its own
+ * database connection, and the text of each subtree is then joined, in
+ * order.
+ */
+struct sqlconf_walk_work {
+  sqlconf_handle_t *h;
+  array_header *ctx_ids;
+  int isbase;
+  int base_id;
+};
+
+static int sqlconf_worker_init_cb(pool *p, unsigned int worker,
+    void *user_data) {
+  struct sqlconf_walk_work *work;
+  char conn_name[64];
+
+  work = user_data;
+
+  /* A worker cannot use the parent's connection, so it opens its own. */
+  memset(conn_name, '\0', sizeof(conn_name));
+  snprintf(conn_name, sizeof(conn_name)-1, "sqlconf-worker%u", worker + 1);
+
+  if (sqlconf_define_conn(work->h, p, conn_name) < 0 ||
+      sqlconf_open_conn(p, conn_name) < 0) {
+    return -1;
+  }
+
+  work->h->conn_name = pstrdup(p, conn_name);
+
+  if (sqlconf_deadline.active == TRUE) {
+    (void) sqlconf_set_stmt_timeout(p, work->h->conn_name, NULL);
+  }
+
+  return 0;
+}
+
+static int sqlconf_worker_item_cb(pool *p, unsigned int item,
+    const char *data, sqlconf_buf_t *buf, void *user_data) {
+  struct sqlconf_walk_work *work;
+
+  work = user_data;
+  work->h->conf = buf;
+
+  if (sqlconf_read_ctx(work->h, p, ((int *) work->ctx_ids->elts)[item],
+      work->isbase, work->base_id) < 0) {
+    return -1;
+  }
+
+  /* Contexts skipped because the deadline passed leave the text incomplete;
+   * the parent then sees the deadline pass for itself.
+   */
+  if (sqlconf_deadline.expired == TRUE) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void sqlconf_worker_exit_cb(pool *p, unsigned int worker,
+    void *user_data) {
+  struct sqlconf_walk_work *work;
+  cmd_rec *cmd;
+
+  work = user_data;
+
+  cmd = sqlconf_cmd_alloc(p, 2, work->h->conn_name, "1");
+  (void) sqlconf_dispatch(cmd, "sql_close_conn");
+  destroy_pool(cmd->pool);
+}
+
+static int sqlconf_read_workers(sqlconf_handle_t *h, pool *p,
+    array_header *bases) {
+  register unsigned int i;
+  struct sqlconf_walk_work work;
+
+  work.h = h;
+  work.ctx_ids = bases;
+  work.isbase = TRUE;
+  work.base_id = 0;
+
+  /* With a single base context, divide its children instead. */
+  if (bases->nelts == 1) {
+    char *ctx_key = NULL;
+    int base_id;
+
+    base_id = ((int *) bases->elts)[0];
+    if (sqlconf_open_ctx(h, p, base_id, TRUE, &ctx_key) < 0) {
+      return -1;
+    }
+
+    work.ctx_ids = sqlconf_get_ctx_ctxs(h, p, base_id);
+    if (work.ctx_ids == NULL) {
+      return -1;
+    }
+
+    work.isbase = FALSE;
+    work.base_id = base_id;
+  }
+
+  if (work.ctx_ids->nelts > 1) {
+    if (sqlconf_workers_run(p, h->workers, work.ctx_ids->nelts,
+        sqlconf_worker_init_cb, sqlconf_worker_item_cb,
+        sqlconf_worker_exit_cb, &work, h->conf) == 0) {
+      return 0;
+    }
+
+    pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+      ": error using workers (%s), reading contexts serially",
+      strerror(errno));
+  }
+
+  for (i = 0; i < work.ctx_ids->nelts; i++) {
+    sqlconf_read_ctx(h, p, ((int *) work.ctx_ids->elts)[i], work.isbase,
+      work.base_id);
+  }
+
+  return 0;
+}
+
+/* The walk is iterative, rather than recursive: the frames of the walk, one
+ * per context being visited, are kept explicitly, on a stack.  For lazy
+ * generation, the walk is resumed whenever the parser has read all of the
+ * text generated so far; the stack is kept between reads.
+ */
+struct sqlconf_frame {
+  pool *pool;
+
+  /* The context visited, and how deeply it is nested within its base
+   * context (at depth zero).
+   */
+  int ctx_id;
+  int depth;
+
+  /* The context type, for the closing tag; NULL for the base context. */
+  const char *type;
+
+  /* The IDs (int) of the child contexts, and the next one to visit. */
+  array_header *ctx_ids;
+  unsigned int next_ctx;
+
+  /* Set for the outermost frame, whose "children" are the base contexts. */
+  int bases;
+};
+
+static int sqlconf_push_frame(sqlconf_handle_t *h, int ctx_id, int isbase,
+    int depth) {
+  struct sqlconf_frame *frame;
+  char *ctx_key = NULL;
+  pool *frame_pool;
+
+  frame_pool = make_sub_pool(h->pool);
+  pr_pool_tag(frame_pool, "SQL Configuration Frame Pool");
+
+  if (sqlconf_open_ctx(h, frame_pool, ctx_id, isbase, &ctx_key) < 0) {
+    int xerrno = errno;
+
+    destroy_pool(frame_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  frame = pcalloc(frame_pool, sizeof(struct sqlconf_frame));
+  frame->pool = frame_pool;
+  frame->ctx_id = ctx_id;
+  frame->depth = depth;
+  frame->type = isbase ? NULL : ctx_key;
+
+  frame->ctx_ids = sqlconf_get_ctx_ctxs(h, frame_pool, ctx_id);
+  if (frame->ctx_ids == NULL) {
+    int xerrno = errno;
+
+    destroy_pool(frame_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  *((struct sqlconf_frame **) push_array(h->frames)) = frame;
+  return 0;
+}
+
+/* Push the outermost frame, whose children are the given base contexts. */
+static int sqlconf_push_bases_frame(sqlconf_handle_t *h, array_header *bases) {
+  struct sqlconf_frame *frame;
+  pool *frame_pool;
+
+  frame_pool = make_sub_pool(h->pool);
+  pr_pool_tag(frame_pool, "SQL Configuration Frame Pool");
+
+  frame = pcalloc(frame_pool, sizeof(struct sqlconf_frame));
+  frame->pool = frame_pool;
+  frame->ctx_ids = make_array(frame_pool, bases->nelts, sizeof(int));
+  array_cat(frame->ctx_ids, bases);
+  frame->depth = -1;
+  frame->bases = TRUE;
+
+  *((struct sqlconf_frame **) push_array(h->frames)) = frame;
+  return 0;
+}
+
+/* Checks that visiting the given context, at the given depth, neither
+ * exceeds the maximum depth, nor loops, i.e. that the context is not already
+ * being visited, further up the stack, because of a cycle of parent IDs.
+ */
+static int sqlconf_check_frame(sqlconf_handle_t *h, int ctx_id, int depth) {
+  register int i;
+
+  if (depth > (int) h->max_depth) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": context ID %d nested more than %u contexts deep, skipping", ctx_id,
+      h->max_depth);
+    errno = ELOOP;
+    return -1;
+  }
+
+  for (i = (int) h->frames->nelts - 1; i >= 0; i--) {
+    struct sqlconf_frame *frame;
+
+    frame = ((struct sqlconf_frame **) h->frames->elts)[i];
+    if (frame->bases == TRUE) {
+      break;
+    }
+
+    if (frame->ctx_id == ctx_id) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": context ID %d is nested within itself (loop of parent IDs), "
+        "skipping", ctx_id);
+      errno = ELOOP;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Prefetching: while the parser reads the text generated for one context,
+ * a worker process, with its own database connection, reads the next context
+ * the walk will visit, so that waiting on the database overlaps parsing.
+ * There is only ever one context in flight.  The worker reads the context's
+ * row, directives, and child IDs, and sends them back as:
+ *
+ *   <+type|.> [<child ID> ...]\n<opening tag and directives>
+ *
+ * or "!" for a missing context.
+ */
+static int sqlconf_prefetch_item_cb(pool *p, unsigned int item,
+    const char *data, sqlconf_buf_t *buf, void *user_data) {
+  register unsigned int i;
+  struct sqlconf_walk_work *work;
+  sqlconf_handle_t *h;
+  array_header *ids;
+  const char *head;
+  char *ctx_key = NULL, *ptr = NULL;
+  int ctx_id, isbase;
+  size_t headlen;
+
+  work = user_data;
+  h = work->h;
+
+  ctx_id = (int) strtol(data, &ptr, 10);
+  isbase = (ptr != NULL && strcmp(ptr, " 1") == 0);
+
+  h->conf = sqlconf_buf_create(p, 0);
+  if (sqlconf_open_ctx(h, p, ctx_id, isbase, &ctx_key) < 0) {
+    if (sqlconf_deadline.expired == TRUE) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    sqlconf_buf_add(buf, "!", NULL);
+    return 0;
+  }
+
+  ids = sqlconf_get_ctx_ctxs(h, p, ctx_id);
+  if (ids == NULL) {
+    return -1;
+  }
+
+  sqlconf_buf_add(buf, ctx_key != NULL && !isbase ? "+" : ".",
+    ctx_key != NULL && !isbase ? ctx_key : "", NULL);
+
+  for (i = 0; i < ids->nelts; i++) {
+    char idstr[32];
+
+    memset(idstr, '\0', sizeof(idstr));
+    snprintf(idstr, sizeof(idstr)-1, " %d", ((int *) ids->elts)[i]);
+    sqlconf_buf_add(buf, idstr, NULL);
+  }
+
+  head = sqlconf_buf_get_text(h->conf, &headlen);
+  sqlconf_buf_add(buf, "\n", head, NULL);
+
+  if (sqlconf_deadline.expired == TRUE) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Splits the text read for a context by sqlconf_prefetch_item_cb() into the
+ * context type (NULL for none), the IDs (int) of its child contexts, and its
+ * opening tag and directives.  Returns 1 if the context was found, 0 if it
+ * was missing, or -1 on error.
+ */
+static int sqlconf_prefetch_split_ctx(pool *p, const char *text,
+    const char **type, array_header **ctx_ids, const char **head) {
+  char *header, *ptr, *token;
+
+  if (*text == '!') {
+    return 0;
+  }
+
+  ptr = strchr(text, '\n');
+  if (ptr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  header = pstrndup(p, text, ptr - text);
+  *head = pstrdup(p, ptr + 1);
+  *type = NULL;
+  *ctx_ids = make_array(p, 1, sizeof(int));
+
+  ptr = strchr(header, ' ');
+  if (ptr != NULL) {
+    *ptr++ = '\0';
+  }
+
+  if (*header == '+') {
+    *type = pstrdup(p, header + 1);
+  }
+
+  while (ptr != NULL) {
+    token = ptr;
+    ptr = strchr(token, ' ');
+    if (ptr != NULL) {
+      *ptr++ = '\0';
+    }
+
+    *((int *) push_array(*ctx_ids)) = atoi(token);
+  }
+
+  return 1;
+}
+
+static void sqlconf_stop_prefetch(sqlconf_handle_t *h) {
+  if (h->prefetch_workers == NULL) {
+    return;
+  }
+
+  (void) sqlconf_workers_stop(h->prefetch_workers);
+  h->prefetch_workers = NULL;
+  h->prefetch_pending = FALSE;
+}
+
+static void sqlconf_start_prefetch(sqlconf_handle_t *h) {
+  struct sqlconf_walk_work *work;
+
+  work = pcalloc(h->pool, sizeof(struct sqlconf_walk_work));
+  work->h = h;
+
+  h->prefetch_workers = sqlconf_workers_start(h->pool, 1,
+    sqlconf_worker_init_cb, sqlconf_prefetch_item_cb, sqlconf_worker_exit_cb,
+    work);
+  if (h->prefetch_workers == NULL) {
+    pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+      ": error starting prefetch worker (%s), reading contexts serially",
+      strerror(errno));
+  }
+}
+
+/* Hands the next context to be visited, i.e. the next child context of the
+ * innermost frame which has any left, to the prefetch worker.
+ */
+static void sqlconf_prefetch_next_ctx(sqlconf_handle_t *h) {
+  register int i;
+  char data[64];
+
+  if (h->prefetch_workers == NULL ||
+      h->prefetch_pending == TRUE) {
+    return;
+  }
+
+  for (i = (int) h->frames->nelts - 1; i >= 0; i--) {
+    struct sqlconf_frame *frame;
+
+    frame = ((struct sqlconf_frame **) h->frames->elts)[i];
+    if (frame->next_ctx < frame->ctx_ids->nelts) {
+      h->prefetch_id = ((int *) frame->ctx_ids->elts)[frame->next_ctx];
+
+      memset(data, '\0', sizeof(data));
+      snprintf(data, sizeof(data)-1, "%d %d", h->prefetch_id,
+        frame->bases ? 1 : 0);
+
+      if (sqlconf_workers_submit(h->prefetch_workers, 0, data) < 0) {
+        sqlconf_stop_prefetch(h);
+        return;
+      }
+
+      h->prefetch_pending = TRUE;
+      return;
+    }
+  }
+}
+
+/* Pushes the frame for the given context using the text read by the prefetch
+ * worker.  Returns -1 if that context was not prefetched, or the prefetch
+ * failed, in which case the caller reads the context itself.
+ */
+static int sqlconf_push_prefetched_frame(sqlconf_handle_t *h, int ctx_id,
+    int depth) {
+  struct sqlconf_frame *frame;
+  array_header *ctx_ids = NULL;
+  const char *head = NULL, *text = NULL, *type = NULL;
+  unsigned int item;
+  int res;
+  pool *frame_pool;
+
+  if (h->prefetch_workers == NULL ||
+      h->prefetch_pending == FALSE) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  h->prefetch_pending = FALSE;
+
+  res = sqlconf_workers_next(h->prefetch_workers, &item, &text, NULL);
+  if (res != 1) {
+    pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+      ": error prefetching context ID %d (%s), reading contexts serially",
+      h->prefetch_id, strerror(errno));
+    sqlconf_stop_prefetch(h);
+    errno = EIO;
+    return -1;
+  }
+
+  if (h->prefetch_id != ctx_id) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  frame_pool = make_sub_pool(h->pool);
+  pr_pool_tag(frame_pool, "SQL Configuration Frame Pool");
+
+  res = sqlconf_prefetch_split_ctx(frame_pool, text, &type, &ctx_ids, &head);
+  if (res <= 0) {
+    int xerrno = errno;
+
+    destroy_pool(frame_pool);
+
+    /* A missing context is skipped, as it would be when read directly. */
+    if (res == 0) {
+      return 0;
+    }
+
+    errno = xerrno;
+    return -1;
+  }
+
+  sqlconf_buf_add(h->conf, head, NULL);
+
+  frame = pcalloc(frame_pool, sizeof(struct sqlconf_frame));
+  frame->pool = frame_pool;
+  frame->ctx_id = ctx_id;
+  frame->depth = depth;
+  frame->type = type;
+  frame->ctx_ids = ctx_ids;
+
+  *((struct sqlconf_frame **) push_array(h->frames)) = frame;
+  return 0;
+}
+
+/* Advance the walk by one step: either descend into the next child context
+ * of the current context, or close the current context.  Returns 1 if a step
+ * was taken, 0 if the walk is complete, or -1 on error.
+ */
+static int sqlconf_step_frames(sqlconf_handle_t *h) {
+  struct sqlconf_frame *frame;
+
+  if (h->frames == NULL ||
+      h->frames->nelts == 0) {
+    return 0;
+  }
+
+  frame = ((struct sqlconf_frame **) h->frames->elts)[
+    h->frames->nelts-1];
+
+  if (frame->next_ctx < frame->ctx_ids->nelts) {
+    int ctx_id;
+
+    ctx_id = ((int *) frame->ctx_ids->elts)[frame->next_ctx++];
+
+    /* A child context which cannot be read, or which would make the walk
+     * too deep, or loop, is skipped.
+     */
+    if (sqlconf_check_frame(h, ctx_id, frame->depth + 1) == 0 &&
+        sqlconf_push_prefetched_frame(h, ctx_id, frame->depth + 1) < 0) {
+      (void) sqlconf_push_frame(h, ctx_id, frame->bases, frame->depth + 1);
+    }
+
+    sqlconf_prefetch_next_ctx(h);
+    return 1;
+  }
+
+  if (frame->type != NULL) {
+    sqlconf_buf_add(h->conf, "</", frame->type, ">\n", NULL);
+  }
+
+  destroy_pool(frame->pool);
+  h->frames->nelts--;
+  return 1;
+}
+
+/* Walks the given context, and every context beneath it, in full.  A
+ * context read on its own, other than a base context, is a child of the
+ * given base context (see sqlconf_read_workers()); the stack then starts
+ * with a frame for that base context, already visited, so that loops back
+ * to it are caught, and depths are counted from it, as for the whole walk.
+ */
+static int sqlconf_read_ctx(sqlconf_handle_t *h, pool *p, int ctx_id,
+    int isbase, int base_id) {
+  array_header *frames;
+  int res;
+
+  frames = h->frames;
+  h->frames = make_array(p, 8, sizeof(struct sqlconf_frame *));
+
+  if (isbase == FALSE) {
+    struct sqlconf_frame *frame;
+
+    frame = pcalloc(p, sizeof(struct sqlconf_frame));
+    frame->pool = make_sub_pool(p);
+    frame->ctx_id = base_id;
+    frame->ctx_ids = make_array(frame->pool, 0, sizeof(int));
+
+    *((struct sqlconf_frame **) push_array(h->frames)) = frame;
+  }
+
+  res = sqlconf_check_frame(h, ctx_id, isbase ? 0 : 1);
+  if (res == 0) {
+    res = sqlconf_push_frame(h, ctx_id, isbase, isbase ? 0 : 1);
+  }
+  if (res == 0) {
+    while (sqlconf_step_frames(h) == 1) {
+    }
+  }
+
+  h->frames = frames;
+  return res;
+}
+
+/* Row cursor: run the given query, handing each row it returns to the given
+ * callback, and then release the result.  Returns the number of rows read,
+ * or -1 on error.  A callback returning -1 stops the cursor, with an error.
+ *
+ * Note that mod_sql hands back the complete result of a query; to keep the
+ * memory held by results bounded, large reads are split into multiple
+ * queries (see page_size), each released once its rows have been consumed.
+ */
+typedef int (*sqlconf_row_cb)(char **row, unsigned int fnum, void *user_data);
+
+static int sqlconf_select_rows(sqlconf_handle_t *h, pool *p, const char *query,
+    sqlconf_row_cb cb, void *user_data) {
+  cmd_rec *cmd = NULL;
+  modret_t *res = NULL;
+  sql_data_t *sd = NULL;
+  register unsigned int i = 0;
+  int count;
+
+  cmd = sqlconf_cmd_alloc(p, 2, h->conn_name, query);
+
+  res = sqlconf_dispatch(cmd, "sql_select");
+  if (MODRET_ISERROR(res)) {
+    int xerrno = errno;
+    const char *errmsg;
+
+    errmsg = MODRET_ERRMSG(res);
+    pr_trace_msg(trace_channel, 9, "SQL SELECT error: %s",
+      errmsg ? errmsg : "(unknown)");
+
+    destroy_pool(cmd->pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  sd = res->data;
+
+  for (i = 0; i < sd->rnum; i++) {
+    if (cb(&(sd->data[i * sd->fnum]), sd->fnum, user_data) < 0) {
+      int xerrno = errno;
+
+      destroy_pool(cmd->pool);
+      errno = xerrno;
+      return -1;
+    }
+  }
+
+  count = (int) sd->rnum;
+  destroy_pool(cmd->pool);
+
+  return count;
+}
+
+struct sqlconf_tree_rows {
+  sqlconf_tree_t *tree;
+
+  /* Optional list onto which the IDs of newly added contexts are pushed. */
+  array_header *ids;
+
+  /* The ID of the last context row read, for paging. */
+  char last_id[64];
+};
+
+static int sqlconf_tree_ctx_row_cb(char **row, unsigned int fnum,
+    void *user_data) {
+  struct sqlconf_tree_rows *rows;
+
+  rows = user_data;
+  sstrncpy(rows->last_id, row[0], sizeof(rows->last_id));
+
+  if (sqlconf_tree_add_ctx(rows->tree, row[0], row[1], row[2], row[3]) < 0) {
+    pr_trace_msg(trace_channel, 3, "skipping context ID '%s': %s",
+      row[0] ? row[0] : "(null)", strerror(errno));
+    return 0;
+  }
+
+  if (rows->ids != NULL) {
+    *((char **) push_array(rows->ids)) = pstrdup(rows->ids->pool, row[0]);
+  }
+
+  return 0;
+}
+
+static int sqlconf_tree_conf_row_cb(char **row, unsigned int fnum,
+    void *user_data) {
+  struct sqlconf_tree_rows *rows;
+
+  rows = user_data;
+  (void) sqlconf_tree_add_conf(rows->tree, row[0], row[1], row[2]);
+  return 0;
+}
+
+/* Run the given query, adding each (id, parent_id, type, value) row it
+ * returns to the tree.  If an array is provided, the IDs of the newly added
+ * contexts are pushed onto it.  If a buffer is provided, the ID of the last
+ * row read is copied into it.  Returns the number of rows read.
+ */
+static int sqlconf_select_tree_ctxs(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree, const char *query, array_header *ids, char *last_id,
+    size_t last_idsz) {
+  struct sqlconf_tree_rows rows;
+  int count;
+
+  memset(&rows, 0, sizeof(rows));
+  rows.tree = tree;
+  rows.ids = ids;
+
+  count = sqlconf_select_rows(h, p, query, sqlconf_tree_ctx_row_cb, &rows);
+  if (count < 0) {
+    return -1;
+  }
+
+  if (last_id != NULL) {
+    sstrncpy(last_id, rows.last_id, last_idsz);
+  }
+
+  pr_trace_msg(trace_channel, 8, "read %d contexts from '%s'", count,
+    h->ctxs.table);
+  return count;
+}
+
+/* Run the given query, adding each (ctx_id, name, value) row it returns to
+ * the tree.  Returns the number of rows read.
+ */
+static int sqlconf_select_tree_confs(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree, const char *query) {
+  struct sqlconf_tree_rows rows;
+  int count;
+
+  memset(&rows, 0, sizeof(rows));
+  rows.tree = tree;
+
+  count = sqlconf_select_rows(h, p, query, sqlconf_tree_conf_row_cb, &rows);
+  if (count < 0) {
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 8, "read %d directives from '%s'", count,
+    h->confs.table);
+  return count;
+}
+
+/* Returns an "IN (...)" list of the given count of IDs, starting at the given
+ * offset.
+ */
+static char *sqlconf_get_in_list(pool *p, array_header *ids,
+    unsigned int offset, unsigned int count) {
+  register unsigned int i;
+  char **elts, *in_list, *ptr;
+  unsigned int end;
+  size_t len;
+
+  elts = ids->elts;
+
+  end = offset + count;
+  if (end > ids->nelts ||
+      end < offset) {
+    end = ids->nelts;
+  }
+
+  /* Measure the list first, so that it is built in one allocation, rather
+   * than copied again for every ID.
+   */
+  len = strlen("IN ()");
+  for (i = offset; i < end; i++) {
+    len += strlen(elts[i]) + (i > offset ? 2 : 0);
+  }
+
+  in_list = ptr = palloc(p, len + 1);
+
+  memcpy(ptr, "IN (", 4);
+  ptr += 4;
+
+  for (i = offset; i < end; i++) {
+    size_t idlen;
+
+    if (i > offset) {
+      memcpy(ptr, ", ", 2);
+      ptr += 2;
+    }
+
+    idlen = strlen(elts[i]);
+    memcpy(ptr, elts[i], idlen);
+    ptr += idlen;
+  }
+
+  *ptr++ = ')';
+  *ptr = '\0';
+
+  return in_list;
+}
+
+/* Returns the query (sans "SELECT") for the (ctx_id, name, value) rows of
+ * every mapped directive, optionally restricted to the contexts matching the
+ * given clause on the map table's context ID.
+ */
+static char *sqlconf_get_confs_query(sqlconf_handle_t *h, pool *p,
+    const char *ctx_id_clause) {
+  char *query;
+
+  query = pstrcat(p, h->maps.table, ".", h->maps.ctx_id_col, ", ",
+    h->confs.name_col, ", ", h->confs.value_col, " FROM ",
+    h->confs.table, " INNER JOIN ", h->maps.table, " ON ",
+    h->confs.table, ".", h->confs.id_col, " = ", h->maps.table,
+    ".", h->maps.conf_id_col, NULL);
+
+  if (ctx_id_clause != NULL) {
+    query = pstrcat(p, query, " WHERE ", h->maps.table, ".",
+      h->maps.ctx_id_col, " ", ctx_id_clause, NULL);
+
+    if (h->confs.where != NULL) {
+      query = pstrcat(p, query, " AND ", h->confs.where, NULL);
+    }
+
+  } else if (h->confs.where != NULL) {
+    query = pstrcat(p, query, " WHERE ", h->confs.where, NULL);
+  }
+
+  return query;
+}
+
+/* Reads the directives for the given context IDs, batch_size contexts per
+ * query, releasing each result as soon as its rows have been added to the
+ * tree.
+ */
+static int sqlconf_select_tree_confs_by_id(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree, array_header *ids) {
+  register unsigned int i;
+
+  for (i = 0; i < ids->nelts; i += h->batch_size) {
+    pool *tmp_pool;
+    char *query;
+    int count;
+
+    tmp_pool = make_sub_pool(p);
+    query = sqlconf_get_confs_query(h, tmp_pool,
+      sqlconf_get_in_list(tmp_pool, ids, i, h->batch_size));
+
+    count = sqlconf_select_tree_confs(h, tmp_pool, tree, query);
+    destroy_pool(tmp_pool);
+
+    if (count < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Returns the requested base contexts (sqlconf_node_t *) in the linked
+ * tree, in order.  As for the per-context walk, a missing base context is
+ * skipped, i.e. it means an empty configuration, but more than one toplevel
+ * context is an error.
+ */
+static array_header *sqlconf_get_tree_bases(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  register unsigned int i;
+  array_header *bases;
+  sqlconf_node_t *base;
+  char **base_ids;
+
+  bases = make_array(p, 1, sizeof(sqlconf_node_t *));
+
+  if (h->ctxs.base_ids == NULL) {
+    base = sqlconf_tree_get_root(tree);
+    if (base == NULL &&
+        errno == EEXIST) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": retrieving default context failed: bad/non-unique results");
+      errno = ENOENT;
+      return NULL;
+    }
+
+    if (base != NULL) {
+      *((sqlconf_node_t **) push_array(bases)) = base;
+    }
+
+    return bases;
+  }
+
+  base_ids = h->ctxs.base_ids->elts;
+  for (i = 0; i < h->ctxs.base_ids->nelts; i++) {
+    base = sqlconf_tree_get_ctx(tree, base_ids[i]);
+    if (base == NULL) {
+      pr_trace_msg(trace_channel, 8, "base context ID %s not found, skipping",
+        base_ids[i]);
+      continue;
+    }
+
+    *((sqlconf_node_t **) push_array(bases)) = base;
+  }
+
+  return bases;
+}
+
+/* Links the loaded tree, and renders the requested base contexts. */
+static int sqlconf_render_tree(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  register unsigned int i;
+  array_header *bases;
+  sqlconf_node_t **elts;
+
+  sqlconf_tree_link(tree);
+
+  bases = sqlconf_get_tree_bases(h, p, tree);
+  if (bases == NULL) {
+    return -1;
+  }
+
+  h->conf = sqlconf_buf_create(h->pool, 0);
+
+  elts = bases->elts;
+  for (i = 0; i < bases->nelts; i++) {
+    sqlconf_tree_render(tree, elts[i], h->max_depth, h->conf);
+  }
+
+  return 0;
+}
+
+/* Returns the query (sans "SELECT") for the context rows matching the given
+ * clause, and any configured WHERE clause.
+ */
+static char *sqlconf_get_ctxs_query(sqlconf_handle_t *h, pool *p,
+    const char *clause) {
+  char *query;
+
+  query = pstrcat(p, h->ctxs.id_col, ", ", h->ctxs.parent_id_col,
+    ", ", h->ctxs.type_col, ", ", h->ctxs.value_col, " FROM ",
+    h->ctxs.table, " WHERE ", clause, NULL);
+
+  if (h->ctxs.where != NULL) {
+    query = pstrcat(p, query, " AND ", h->ctxs.where, NULL);
+  }
+
+  return query;
+}
+
+/* Read every context row, page_size rows per query, in ID order; then read
+ * the directives for those contexts, batch_size contexts per query.  Each
+ * result is released as soon as its rows have been added to the tree, so
+ * that at most one page of results is held at a time.
+ */
+static int sqlconf_read_bulk_pages(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  char last_id[64], limit[32];
+  array_header *ids;
+  int count;
+
+  ids = make_array(p, 64, sizeof(char *));
+
+  memset(last_id, '\0', sizeof(last_id));
+  memset(limit, '\0', sizeof(limit));
+  snprintf(limit, sizeof(limit)-1, "%u", h->page_size);
+
+  do {
+    pool *tmp_pool;
+    char *clause, *query;
+
+    tmp_pool = make_sub_pool(p);
+
+    if (*last_id == '\0') {
+      clause = pstrcat(tmp_pool, h->ctxs.id_col, " IS NOT NULL", NULL);
+
+    } else {
+      clause = pstrcat(tmp_pool, h->ctxs.id_col, " > ", last_id, NULL);
+    }
+
+    query = pstrcat(tmp_pool, sqlconf_get_ctxs_query(h, tmp_pool, clause),
+      " ORDER BY ", h->ctxs.id_col, " LIMIT ", limit, NULL);
+
+    count = sqlconf_select_tree_ctxs(h, tmp_pool, tree, query, ids, last_id,
+      sizeof(last_id));
+    destroy_pool(tmp_pool);
+
+    if (count < 0) {
+      return -1;
+    }
+
+  } while ((unsigned int) count == h->page_size);
+
+  return sqlconf_select_tree_confs_by_id(h, p, tree, ids);
+}
+
+/* Read every context row, and every mapped directive, using a fixed number
+ * of queries regardless of the size of the configuration; the parent/child
+ * links are then made in memory.
+ */
+static int sqlconf_read_bulk(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  char *query = NULL;
+
+  if (h->page_size > 0) {
+    return sqlconf_read_bulk_pages(h, p, tree);
+  }
+
+  query = pstrcat(p, h->ctxs.id_col, ", ", h->ctxs.parent_id_col,
+    ", ", h->ctxs.type_col, ", ", h->ctxs.value_col, " FROM ",
+    h->ctxs.table, NULL);
+  if (h->ctxs.where != NULL) {
+    query = pstrcat(p, query, " WHERE ", h->ctxs.where, NULL);
+  }
+
+  if (sqlconf_select_tree_ctxs(h, p, tree, query, NULL, NULL, 0) < 0) {
+    return -1;
+  }
+
+  query = sqlconf_get_confs_query(h, p, NULL);
+  if (sqlconf_select_tree_confs(h, p, tree, query) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Returns a recursive common table expression, named "sqlconf_subtree",
+ * yielding the (ctx_id, parent_id, type, value, depth) rows of the base
+ * contexts (at most batch_size of them, starting at the given offset) and
+ * every context beneath them.
+ */
+static char *sqlconf_get_subtree_cte(sqlconf_handle_t *h, pool *p,
+    unsigned int offset) {
+  char *ctxs, *anchor, depth[32];
+
+  /* Apply any configured WHERE clause to the context table once, up front,
+   * so that it does not need to be qualified in the joins below.
+   */
+  ctxs = pstrcat(p, "(SELECT ", h->ctxs.id_col, " AS ctx_id, ",
+    h->ctxs.parent_id_col, " AS parent_id, ", h->ctxs.type_col,
+    " AS type, ", h->ctxs.value_col, " AS value FROM ",
+    h->ctxs.table, NULL);
+  if (h->ctxs.where != NULL) {
+    ctxs = pstrcat(p, ctxs, " WHERE ", h->ctxs.where, NULL);
+  }
+  ctxs = pstrcat(p, ctxs, ")", NULL);
+
+  if (h->ctxs.base_ids == NULL) {
+    anchor = "parent_id IS NULL";
+
+  } else {
+    anchor = pstrcat(p, "ctx_id ", sqlconf_get_in_list(p, h->ctxs.base_ids,
+      offset, h->batch_size), NULL);
+  }
+
+  /* Bound the recursion, lest a parent_id loop in the table recurse
+   * forever.
+   */
+  memset(depth, '\0', sizeof(depth));
+  snprintf(depth, sizeof(depth)-1, "%u", h->max_depth);
+
+  return pstrcat(p, "WITH RECURSIVE sqlconf_subtree ",
+    "(ctx_id, parent_id, type, value, depth) AS (",
+      "SELECT ctx_id, parent_id, type, value, 0 FROM ", ctxs, " sqlconf_base",
+      " WHERE ", anchor,
+      " UNION ALL ",
+      "SELECT c.ctx_id, c.parent_id, c.type, c.value, s.depth + 1 FROM ",
+      ctxs, " c INNER JOIN sqlconf_subtree s ON c.parent_id = s.ctx_id",
+      " WHERE s.depth < ", depth,
+    ")", NULL);
+}
+
+/* Read the base contexts, and everything beneath them, using one recursive
+ * query for the contexts, and one for their directives.
+ */
+static int sqlconf_read_cte(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  register unsigned int i;
+  char *cte, *query = NULL;
+  array_header *ids;
+
+  if (h->ctxs.base_ids == NULL ||
+      h->ctxs.base_ids->nelts <= h->batch_size) {
+    cte = sqlconf_get_subtree_cte(h, p, 0);
+
+    /* Note that mod_sql prepends "SELECT " to our query text, which is why
+     * the CTE is wrapped in a derived table.
+     */
+    query = pstrcat(p, "ctx_id, parent_id, type, value FROM (", cte,
+      " SELECT ctx_id, parent_id, type, value, depth FROM sqlconf_subtree)",
+      " sqlconf_ctxs ORDER BY ctx_id", NULL);
+
+    if (sqlconf_select_tree_ctxs(h, p, tree, query, NULL, NULL, 0) < 0) {
+      return -1;
+    }
+
+    query = sqlconf_get_confs_query(h, p, pstrcat(p,
+      "IN (SELECT ctx_id FROM (", cte,
+      " SELECT ctx_id FROM sqlconf_subtree) sqlconf_ids)", NULL));
+
+    if (sqlconf_select_tree_confs(h, p, tree, query) < 0) {
+      return -1;
+    }
+
+    return 0;
+  }
+
+  /* With more base contexts than fit in one "IN (...)" list, read the
+   * contexts beneath each batch_size of them in turn, then the directives for
+   * every context read; a context beneath more than one batch is only added,
+   * and so only has its directives read, once.
+   */
+  ids = make_array(p, 64, sizeof(char *));
+
+  for (i = 0; i < h->ctxs.base_ids->nelts; i += h->batch_size) {
+    pool *tmp_pool;
+    int count;
+
+    tmp_pool = make_sub_pool(p);
+
+    cte = sqlconf_get_subtree_cte(h, tmp_pool, i);
+    query = pstrcat(tmp_pool, "ctx_id, parent_id, type, value FROM (", cte,
+      " SELECT ctx_id, parent_id, type, value, depth FROM sqlconf_subtree)",
+      " sqlconf_ctxs ORDER BY ctx_id", NULL);
+
+    count = sqlconf_select_tree_ctxs(h, tmp_pool, tree, query, ids, NULL, 0);
+    destroy_pool(tmp_pool);
+
+    if (count < 0) {
+      return -1;
+    }
+  }
+
+  return sqlconf_select_tree_confs_by_id(h, p, tree, ids);
+}
+
+/* Read the children, and the directives, of the given contexts, using
+ * "IN (...)" lists of at most batch_size IDs each.  The IDs of the children
+ * read are pushed onto the next level.
+ */
+static int sqlconf_read_level_ctxs(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree, array_header *level, array_header *next) {
+  register unsigned int i;
+
+  for (i = 0; i < level->nelts; i += h->batch_size) {
+    char *in_list, *query;
+
+    in_list = sqlconf_get_in_list(p, level, i, h->batch_size);
+
+    /* When reading the whole configuration, every directive has already been
+     * read.
+     */
+    if (h->ctxs.base_ids != NULL) {
+      query = sqlconf_get_confs_query(h, p, in_list);
+      if (sqlconf_select_tree_confs(h, p, tree, query) < 0) {
+        return -1;
+      }
+    }
+
+    query = sqlconf_get_ctxs_query(h, p, pstrcat(p, h->ctxs.parent_id_col,
+      " ", in_list, NULL));
+    if (sqlconf_select_tree_ctxs(h, p, tree, query, next, NULL, 0) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Orders contexts by ID. */
+static int sqlconf_cmp_ctx_ids(const void *a, const void *b) {
+  const sqlconf_node_t *node_a, *node_b;
+
+  node_a = *((const sqlconf_node_t **) a);
+  node_b = *((const sqlconf_node_t **) b);
+
+  if (node_a->id == node_b->id) {
+    return 0;
+  }
+
+  return node_a->id < node_b->id ? -1 : 1;
+}
+
+/* Returns the ID of the given context as text, e.g. for queries. */
+static const char *sqlconf_get_node_id(pool *p, sqlconf_node_t *node) {
+  char idstr[64];
+
+  memset(idstr, '\0', sizeof(idstr));
+  snprintf(idstr, sizeof(idstr)-1, "%lld", (long long) node->id);
+  return pstrdup(p, idstr);
+}
+
+/* Returns the contexts of the given linked tree at or beneath any of the base
+ * contexts, each once, in ID order.  Adding them to a tree in that order
+ * keeps the order of siblings the same as when reading a single base
+ * context, even if one base context is beneath another.
+ */
+static array_header *sqlconf_get_subtree_ctxs(pool *p, sqlconf_tree_t *tree,
+    array_header *bases) {
+  register unsigned int i;
+  array_header *ctxs, *stack;
+  sqlconf_node_t **elts;
+
+  ctxs = make_array(p, 64, sizeof(sqlconf_node_t *));
+  stack = make_array(p, 8, sizeof(sqlconf_node_t *));
+  array_cat(stack, bases);
+
+  while (stack->nelts > 0) {
+    sqlconf_node_t *node, *child;
+
+    stack->nelts--;
+    node = ((sqlconf_node_t **) stack->elts)[stack->nelts];
+    *((sqlconf_node_t **) push_array(ctxs)) = node;
+
+    for (child = sqlconf_tree_get_node(tree, node->first_child);
+         child != NULL;
+         child = sqlconf_tree_get_node(tree, child->next_sibling)) {
+      *((sqlconf_node_t **) push_array(stack)) = child;
+    }
+  }
+
+  qsort(ctxs->elts, ctxs->nelts, sizeof(sqlconf_node_t *),
+    sqlconf_cmp_ctx_ids);
+
+  /* Drop the duplicates, from base contexts beneath other base contexts. */
+  elts = ctxs->elts;
+  if (ctxs->nelts > 1) {
+    unsigned int nelts = 1;
+
+    for (i = 1; i < ctxs->nelts; i++) {
+      if (elts[i] != elts[nelts-1]) {
+        elts[nelts++] = elts[i];
+      }
+    }
+
+    ctxs->nelts = nelts;
+  }
+
+  return ctxs;
+}
+
+/* Read the base contexts, and everything beneath them, breadth-first: for
+ * each level of the tree, one query reads the children of every context in
+ * that level, and one reads their directives.  Unlike the CTE strategy, this
+ * works with any database.
+ */
+static int sqlconf_read_levels(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  register unsigned int depth;
+  char *clause;
+  array_header *level;
+
+  level = make_array(p, 1, sizeof(char *));
+
+  if (h->ctxs.base_ids == NULL) {
+    clause = pstrcat(p, h->ctxs.parent_id_col, " IS NULL", NULL);
+
+    if (sqlconf_select_tree_confs(h, p, tree,
+        sqlconf_get_confs_query(h, p, NULL)) < 0) {
+      return -1;
+    }
+
+    if (sqlconf_select_tree_ctxs(h, p, tree,
+        sqlconf_get_ctxs_query(h, p, clause), level, NULL, 0) < 0) {
+      return -1;
+    }
+
+  } else {
+    register unsigned int i;
+
+    for (i = 0; i < h->ctxs.base_ids->nelts; i += h->batch_size) {
+      clause = pstrcat(p, h->ctxs.id_col, " ",
+        sqlconf_get_in_list(p, h->ctxs.base_ids, i, h->batch_size), NULL);
+
+      if (sqlconf_select_tree_ctxs(h, p, tree,
+          sqlconf_get_ctxs_query(h, p, clause), level, NULL, 0) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  /* Contexts already in the tree are not added again, thus a parent_id loop
+   * in the table ends the traversal; the depth is bounded regardless.
+   */
+  for (depth = 0; level->nelts > 0 && depth < h->max_depth; depth++) {
+    pool *tmp_pool;
+    array_header *next;
+
+    tmp_pool = make_sub_pool(p);
+    next = make_array(p, level->nelts, sizeof(char *));
+
+    if (sqlconf_read_level_ctxs(h, tmp_pool, tree, level, next) < 0) {
+      int xerrno = errno;
+
+      destroy_pool(tmp_pool);
+      errno = xerrno;
+      return -1;
+    }
+
+    pr_trace_msg(trace_channel, 9, "read %u contexts at depth %u",
+      next->nelts, depth + 1);
+    destroy_pool(tmp_pool);
+    level = next;
+  }
+
+  return 0;
+}
+
+static int sqlconf_read_level(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  register unsigned int i;
+  sqlconf_tree_t *levels;
+  sqlconf_node_t **elts;
+  array_header *bases, *ctxs;
+
+  if (h->ctxs.base_ids == NULL ||
+      h->ctxs.base_ids->nelts < 2) {
+    return sqlconf_read_levels(h, p, tree);
+  }
+
+  /* With several base contexts, one may be beneath another, and thus read
+   * before its siblings; add the contexts read to the tree in ID order
+   * instead, as the CTE strategy reads them.
+   */
+  levels = sqlconf_tree_create(p);
+  if (sqlconf_read_levels(h, p, levels) < 0) {
+    return -1;
+  }
+
+  sqlconf_tree_link(levels);
+  bases = sqlconf_get_tree_bases(h, p, levels);
+  if (bases == NULL) {
+    return -1;
+  }
+
+  ctxs = sqlconf_get_subtree_ctxs(p, levels, bases);
+  elts = ctxs->elts;
+  for (i = 0; i < ctxs->nelts; i++) {
+    (void) sqlconf_tree_copy_ctx(tree, levels, elts[i]);
+  }
+
+  return 0;
+}
+
+/* Read the configuration into the given in-memory tree, per the configured
+ * strategy.
+ */
+static int sqlconf_fill_tree(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree) {
+  switch (h->strategy) {
+    case CONF_SQL_STRATEGY_BULK:
+      return sqlconf_read_bulk(h, p, tree);
+
+    case CONF_SQL_STRATEGY_CTE:
+      return sqlconf_read_cte(h, p, tree);
+
+    case CONF_SQL_STRATEGY_LEVEL:
+      return sqlconf_read_level(h, p, tree);
+
+    default:
+      break;
+  }
+
+  errno = EINVAL;
+  return -1;
+}
+
+/* Context versions
+ *
+ * If the context table has a version column, changed whenever a context row
+ * or its directives are changed, the tree constructed for a URI is kept
+ * across restarts.  Later loads read only the (id, parent_id, version) of
+ * each context; only the contexts whose version (or parent) differs from the
+ * kept tree are read again, and the rest are copied from the kept tree.  If
+ * the hashes of the resulting base contexts match those of the kept tree,
+ * the kept configuration text is reused as is.
+ */
+struct sqlconf_versions {
+  pool *pool;
+  sqlconf_tree_t *tree;
+
+  /* The number of base contexts found, and the hash of their hashes. */
+  unsigned int nbases;
+  uint64_t bases_hash;
+
+  const char *text;
+  size_t textlen;
+};
+
+static pr_table_t *sqlconf_versions = NULL;
+
+static int sqlconf_tree_version_row_cb(char **row, unsigned int fnum,
+    void *user_data) {
+  sqlconf_tree_t *tree;
+
+  tree = user_data;
+  if (sqlconf_tree_add_ctx(tree, row[0], row[1], "", NULL) < 0) {
+    return 0;
+  }
+
+  (void) sqlconf_tree_set_version(tree, row[0], row[2] ? row[2] : "");
+  return 0;
+}
+
+/* Whether the kept context is the same version, with the same parent, as the
+ * listed context.  Contexts without versions are always read again.
+ */
+static int sqlconf_same_version(sqlconf_tree_t *kept_tree,
+    sqlconf_node_t *kept, sqlconf_tree_t *listing, sqlconf_node_t *listed) {
+  const char *kept_version, *listed_version;
+
+  if (kept == NULL) {
+    return FALSE;
+  }
+
+  kept_version = sqlconf_tree_get_str(kept_tree, kept->version);
+  listed_version = sqlconf_tree_get_str(listing, listed->version);
+  if (kept_version == NULL ||
+      listed_version == NULL ||
+      *listed_version == '\0' ||
+      strcmp(kept_version, listed_version) != 0) {
+    return FALSE;
+  }
+
+  if (kept->have_parent == FALSE ||
+      listed->have_parent == FALSE) {
+    return kept->have_parent == listed->have_parent;
+  }
+
+  return kept->parent_id == listed->parent_id;
+}
+
+/* Read the changed contexts, and their directives, using "IN (...)" lists of
+ * at most batch_size IDs each.
+ */
+static int sqlconf_read_changed_ctxs(sqlconf_handle_t *h, pool *p,
+    sqlconf_tree_t *tree, array_header *ids) {
+  register unsigned int i;
+
+  for (i = 0; i < ids->nelts; i += h->batch_size) {
+    pool *tmp_pool;
+    char *in_list, *query;
+    int res;
+
+    tmp_pool = make_sub_pool(p);
+    in_list = sqlconf_get_in_list(tmp_pool, ids, i, h->batch_size);
+
+    query = sqlconf_get_ctxs_query(h, tmp_pool, pstrcat(tmp_pool,
+      h->ctxs.id_col, " ", in_list, NULL));
+    res = sqlconf_select_tree_ctxs(h, tmp_pool, tree, query, NULL, NULL, 0);
+
+    if (res >= 0) {
+      query = sqlconf_get_confs_query(h, tmp_pool, in_list);
+      res = sqlconf_select_tree_confs(h, tmp_pool, tree, query);
+    }
+
+    destroy_pool(tmp_pool);
+
+    if (res < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Combines the hashes of the given base contexts, in order. */
+static uint64_t sqlconf_hash_bases(array_header *bases) {
+  register unsigned int i;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  sqlconf_node_t **elts;
+
+  elts = bases->elts;
+  for (i = 0; i < bases->nelts; i++) {
+    register unsigned int j;
+
+    for (j = 0; j < sizeof(elts[i]->hash); j++) {
+      hash ^= (elts[i]->hash >> (j * 8)) & 0xff;
+      hash *= 0x100000001b3ULL;
+    }
+  }
+
+  return hash;
+}
+
+static int sqlconf_read_versions(sqlconf_handle_t *h, pool *p) {
+  register unsigned int i;
+  const void *v;
+  const char *text;
+  char *query;
+  struct sqlconf_versions *kept = NULL, *versions;
+  sqlconf_tree_t *listing, *changed, *tree, **srcs;
+  sqlconf_node_t **listed;
+  const char **listed_ids;
+  array_header *bases, *ctxs, *ids;
+  pool *tree_pool;
+
+  if (sqlconf_versions != NULL) {
+    v = pr_table_get(sqlconf_versions, h->uri, NULL);
+    if (v != NULL) {
+      kept = (struct sqlconf_versions *) v;
+    }
+  }
+
+  /* Read the versions first, so that a context changed while its contents
+   * are being read is simply read again next time.
+   */
+  query = pstrcat(p, h->ctxs.id_col, ", ", h->ctxs.parent_id_col, ", ",
+    h->ctxs.version_col, " FROM ", h->ctxs.table, NULL);
+  if (h->ctxs.where != NULL) {
+    query = pstrcat(p, query, " WHERE ", h->ctxs.where, NULL);
+  }
+  query = pstrcat(p, query, " ORDER BY ", h->ctxs.id_col, NULL);
+
+  listing = sqlconf_tree_create(p);
+  if (sqlconf_select_rows(h, p, query, sqlconf_tree_version_row_cb,
+      listing) < 0) {
+    return -1;
+  }
+
+  sqlconf_tree_link(listing);
+  bases = sqlconf_get_tree_bases(h, p, listing);
+  if (bases == NULL) {
+    return -1;
+  }
+
+  if (bases->nelts == 0) {
+    h->conf = sqlconf_buf_create(h->pool, 0);
+    return 0;
+  }
+
+  ctxs = sqlconf_get_subtree_ctxs(p, listing, bases);
+  listed = ctxs->elts;
+
+  /* For each listed context, its ID, and the tree from which to copy it;
+   * NULL means that it is read again.
+   */
+  listed_ids = pcalloc(p, ctxs->nelts * sizeof(const char *));
+  srcs = pcalloc(p, ctxs->nelts * sizeof(sqlconf_tree_t *));
+  ids = make_array(p, 8, sizeof(char *));
+
+  for (i = 0; i < ctxs->nelts; i++) {
+    listed_ids[i] = sqlconf_get_node_id(p, listed[i]);
+
+    if (kept != NULL &&
+        sqlconf_same_version(kept->tree,
+          sqlconf_tree_get_ctx(kept->tree, listed_ids[i]), listing,
+          listed[i]) == TRUE) {
+      srcs[i] = kept->tree;
+      continue;
+    }
+
+    *((const char **) push_array(ids)) = listed_ids[i];
+  }
+
+  changed = sqlconf_tree_create(p);
+
+  if (kept == NULL) {
+    pr_trace_msg(trace_channel, 8, "reading all %u contexts", ctxs->nelts);
+    if (sqlconf_fill_tree(h, p, changed) < 0) {
+      return -1;
+    }
+
+  } else {
+    pr_trace_msg(trace_channel, 8, "reading %u of %u contexts again",
+      ids->nelts, ctxs->nelts);
+    if (sqlconf_read_changed_ctxs(h, p, changed, ids) < 0) {
+      return -1;
+    }
+  }
+
+  tree_pool = make_sub_pool(conf_sql_pool);
+  pr_pool_tag(tree_pool, "SQL Configuration Versions Pool");
+
+  tree = sqlconf_tree_create(tree_pool);
+  for (i = 0; i < ctxs->nelts; i++) {
+    sqlconf_tree_t *src;
+    sqlconf_node_t *node;
+    const char *version;
+
+    src = srcs[i] != NULL ? srcs[i] : changed;
+    node = sqlconf_tree_get_ctx(src, listed_ids[i]);
+    if (node == NULL) {
+      /* Removed since it was listed. */
+      continue;
+    }
+
+    if (sqlconf_tree_copy_ctx(tree, src, node) < 0) {
+      continue;
+    }
+
+    version = sqlconf_tree_get_str(listing, listed[i]->version);
+    (void) sqlconf_tree_set_version(tree, listed_ids[i],
+      version != NULL ? version : "");
+  }
+
+  sqlconf_tree_link(tree);
+  sqlconf_tree_hash(tree);
+
+  bases = sqlconf_get_tree_bases(h, p, tree);
+  if (bases == NULL) {
+    int xerrno = errno;
+
+    destroy_pool(tree_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  versions = pcalloc(tree_pool, sizeof(struct sqlconf_versions));
+  versions->pool = tree_pool;
+  versions->tree = tree;
+  versions->nbases = bases->nelts;
+  versions->bases_hash = sqlconf_hash_bases(bases);
+
+  if (kept != NULL &&
+      kept->nbases == versions->nbases &&
+      kept->bases_hash == versions->bases_hash) {
+    pr_trace_msg(trace_channel, 8,
+      "base contexts unchanged, reusing configuration");
+
+    h->conf = sqlconf_buf_create(h->pool, kept->textlen + 1);
+    sqlconf_buf_add(h->conf, kept->text, NULL);
+
+  } else {
+    sqlconf_node_t **elts;
+
+    h->conf = sqlconf_buf_create(h->pool, 0);
+
+    elts = bases->elts;
+    for (i = 0; i < bases->nelts; i++) {
+      sqlconf_tree_render(tree, elts[i], h->max_depth, h->conf);
+    }
+  }
+
+  text = sqlconf_buf_get_text(h->conf, &(versions->textlen));
+  versions->text = pstrndup(tree_pool, text, versions->textlen);
+
+  /* Replace the kept tree. */
+  if (sqlconf_versions == NULL) {
+    sqlconf_versions = pr_table_alloc(conf_sql_pool, 0);
+  }
+
+  if (kept != NULL) {
+    (void) pr_table_remove(sqlconf_versions, h->uri, NULL);
+    destroy_pool(kept->pool);
+  }
+
+  if (pr_table_add(sqlconf_versions, pstrdup(tree_pool, h->uri), versions,
+      sizeof(struct sqlconf_versions *)) < 0) {
+    pr_trace_msg(trace_channel, 3, "error keeping context versions: %s",
+      strerror(errno));
+    destroy_pool(tree_pool);
+  }
+
+  return 0;
+}
+
+/* Returns the key identifying the rows read for this handle: its connection,
+ * and the tables, columns, and WHERE clauses used.
+ */
+static const char *sqlconf_get_memo_key(sqlconf_handle_t *h, pool *p) {
+  return pstrcat(p, h->conn_name,
+    "|", h->ctxs.table, "|", h->ctxs.id_col, "|", h->ctxs.parent_id_col,
+    "|", h->ctxs.type_col, "|", h->ctxs.value_col,
+    "|", h->ctxs.where ? h->ctxs.where : "",
+    "|", h->confs.table, "|", h->confs.id_col, "|", h->confs.name_col,
+    "|", h->confs.value_col, "|", h->confs.where ? h->confs.where : "",
+    "|", h->maps.table, "|", h->maps.conf_id_col, "|", h->maps.ctx_id_col,
+    "|", h->maps.where ? h->maps.where : "", NULL);
+}
+
+static void sqlconf_clear_memos(void) {
+  if (sqlconf_memo_pool == NULL) {
+    return;
+  }
+
+  destroy_pool(sqlconf_memo_pool);
+  sqlconf_memo_pool = NULL;
+  sqlconf_memos = NULL;
+}
+
+/* Read the configuration into an in-memory tree, per the configured
+ * strategy, and render it.
+ */
+static int sqlconf_read_tree(sqlconf_handle_t *h, pool *p) {
+  const char *key;
+  sqlconf_tree_t *tree = NULL;
+  pool *tree_pool;
+
+  if (h->ctxs.version_col != NULL) {
+    return sqlconf_read_versions(h, p);
+  }
+
+  key = sqlconf_get_memo_key(h, p);
+
+  if (sqlconf_memos != NULL) {
+    const void *v;
+
+    v = pr_table_get(sqlconf_memos, key, NULL);
+    if (v != NULL) {
+      pr_trace_msg(trace_channel, 8,
+        "using tables already read during this parse");
+      tree = (sqlconf_tree_t *) v;
+      return sqlconf_render_tree(h, p, tree);
+    }
+  }
+
+  if (h->strategy != CONF_SQL_STRATEGY_BULK) {
+    tree = sqlconf_tree_create(p);
+    if (sqlconf_fill_tree(h, p, tree) < 0) {
+      return -1;
+    }
+
+    return sqlconf_render_tree(h, p, tree);
+  }
+
+  /* The bulk strategy reads every context, whatever the base context, so
+   * keep the tree for the rest of the parse.
+   */
+  if (sqlconf_memo_pool == NULL) {
+    sqlconf_memo_pool = make_sub_pool(conf_sql_pool);
+    pr_pool_tag(sqlconf_memo_pool, "SQL Configuration Memo Pool");
+
+    sqlconf_memos = pr_table_alloc(sqlconf_memo_pool, 0);
+  }
+
+  tree_pool = make_sub_pool(sqlconf_memo_pool);
+  tree = sqlconf_tree_create(tree_pool);
+
+  if (sqlconf_fill_tree(h, p, tree) < 0) {
+    int xerrno = errno;
+
+    destroy_pool(tree_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (pr_table_add(sqlconf_memos, pstrdup(tree_pool, key), tree,
+      sizeof(sqlconf_tree_t *)) < 0) {
+    pr_trace_msg(trace_channel, 3, "error keeping tables read: %s",
+      strerror(errno));
+  }
+
+  return sqlconf_render_tree(h, p, tree);
+}
+
+/* Connections
+ */
+
+static int sqlconf_load_backend(pool *p, const char *driver) {
+  cmd_rec *cmd = NULL;
+  modret_t *res = NULL;
+
+  /* Load the SQL backend module we'll be using. */
+  if (driver == NULL) {
+    cmd = sqlconf_cmd_alloc(p, 0);
+
+  } else {
+    cmd = sqlconf_cmd_alloc(p, 1, driver);
+  }
+
+  res = sqlconf_dispatch(cmd, "sql_load_backend");
+  destroy_pool(cmd->pool);
+  if (MODRET_ISERROR(res)) {
+    int xerrno = errno;
+    const char *errmsg;
+
+    errmsg = MODRET_ERRMSG(res);
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error loading database backend: %s",
+      errmsg ? errmsg : strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Whether the two driver names, either of which may be NULL (for the
+ * default backend), are the same.
+ */
+static int sqlconf_same_driver(const char *a, const char *b) {
+  if (a == NULL ||
+      b == NULL) {
+    return a == b;
+  }
+
+  return strcmp(a, b) == 0;
+}
+
+static int sqlconf_prepare_backend(pool *p, const char *driver) {
+  register unsigned int i;
+  const char **drivers;
+  cmd_rec *cmd = NULL;
+  modret_t *res = NULL;
+
+  /* Each backend is prepared only once per parse; preparing it again would
+   * discard its connections.
+   */
+  drivers = sqlconf_drivers->elts;
+  for (i = 0; i < sqlconf_drivers->nelts; i++) {
+    if (sqlconf_same_driver(drivers[i], driver) == TRUE) {
+      return 0;
+    }
+  }
+
+  /* Prepare the SQL subsystem. */
+  cmd = sqlconf_cmd_alloc(p, 1, make_sub_pool(sqlconf_conns_pool));
+  res = sqlconf_dispatch(cmd, "sql_prepare");
+  destroy_pool(cmd->pool);
+  if (MODRET_ISERROR(res)) {
+    const char *errmsg;
+
+    errmsg = MODRET_ERRMSG(res);
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error preparing database backend: %s",
+      errmsg ? errmsg : strerror(errno));
+
+    errno = EINVAL;
+    return -1;
+  }
+
+  *((const char **) push_array(sqlconf_drivers)) = driver;
+  return 0;
+}
+
+/* Defines the named connection to the handle's database. */
+static int sqlconf_define_conn(sqlconf_handle_t *h, pool *p,
+    const char *conn_name) {
+  cmd_rec *cmd = NULL;
+  modret_t *res = NULL;
+  const char *username, *password, *dsn;
+
+  /* Define the connection we'll be making.
+   *
+   * IFF we have a username, password, AND database, we assume we need to
+   * use a DSN formatted for a network-connected database.
+   */
+  username = h->db.username;
+  password = h->db.password;
+  if (h->db.username != NULL &&
+      h->db.password != NULL &&
+      h->db.database != NULL) {
+    dsn = pstrcat(p, h->db.database, "@", h->db.server, NULL);
+
+  } else {
+    dsn = h->db.server;
+  }
+
+  cmd = sqlconf_cmd_alloc(p, 4, conn_name, username, password, dsn);
+  res = sqlconf_dispatch(cmd, "sql_define_conn");
+  destroy_pool(cmd->pool);
+  if (MODRET_ISERROR(res)) {
+    const char *errmsg;
+
+    errmsg = MODRET_ERRMSG(res);
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error defining database connection: %s",
+      errmsg ? errmsg : strerror(errno));
+
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int sqlconf_open_conn(pool *p, const char *conn_name) {
+  cmd_rec *cmd = NULL;
+  modret_t *res = NULL;
+
+  /* Open a connection to the database. */
+  cmd = sqlconf_cmd_alloc(p, 1, conn_name);
+  res = sqlconf_dispatch(cmd, "sql_open_conn");
+  destroy_pool(cmd->pool);
+  if (MODRET_ISERROR(res)) {
+    const char *errmsg;
+
+    errmsg = MODRET_ERRMSG(res);
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error opening database connection: %s",
+      errmsg ? errmsg : strerror(errno));
+
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Opens the connection to the handle's database, or reuses the connection
+ * already opened for the same database during this parse.
+ */
+static int sqlconf_open_db(sqlconf_handle_t *h, pool *p, const char *driver) {
+  struct sqlconf_conn *conn = NULL;
+  const void *v;
+  const char *key;
+
+  if (sqlconf_conns_pool == NULL) {
+    sqlconf_conns_pool = make_sub_pool(conf_sql_pool);
+    pr_pool_tag(sqlconf_conns_pool, "SQL Configuration Connections Pool");
+
+    sqlconf_conns = pr_table_alloc(sqlconf_conns_pool, 0);
+    sqlconf_conn_list = make_array(sqlconf_conns_pool, 1,
+      sizeof(struct sqlconf_conn *));
+    sqlconf_drivers = make_array(sqlconf_conns_pool, 1, sizeof(char *));
+  }
+
+  if (driver != NULL) {
+    /* The mod_sql_sqlite module uses a backend name of "sqlite3"; check
+     * the driver name to see if that what was intended.
+     */
+    if (strcasecmp(driver, "sqlite") == 0) {
+      driver = "sqlite3";
+    }
+
+    driver = pstrdup(sqlconf_conns_pool, driver);
+  }
+
+  key = pstrcat(p, driver ? driver : "", "|",
+    h->db.server ? h->db.server : "", "|",
+    h->db.database ? h->db.database : "", "|",
+    h->db.username ? h->db.username : "", NULL);
+
+  v = pr_table_get(sqlconf_conns, key, NULL);
+  if (v != NULL) {
+    conn = (struct sqlconf_conn *) v;
+  }
+
+  /* Another backend may have been loaded since this connection was opened,
+   * so always (re)load this one.
+   */
+  if (sqlconf_load_backend(p, driver) < 0) {
+    return -1;
+  }
+
+  if (sqlconf_prepare_backend(p, driver) < 0) {
+    return -1;
+  }
+
+  if (conn == NULL) {
+    char conn_name[64];
+
+    memset(conn_name, '\0', sizeof(conn_name));
+    if (sqlconf_conn_list->nelts == 0) {
+      sstrncpy(conn_name, sqlconf_conn_prefix, sizeof(conn_name));
+
+    } else {
+      snprintf(conn_name, sizeof(conn_name)-1, "%s%u", sqlconf_conn_prefix,
+        sqlconf_conn_list->nelts + 1);
+    }
+
+    if (sqlconf_define_conn(h, p, conn_name) < 0) {
+      return -1;
+    }
+
+    conn = pcalloc(sqlconf_conns_pool, sizeof(struct sqlconf_conn));
+    conn->name = pstrdup(sqlconf_conns_pool, conn_name);
+    conn->driver = driver;
+
+    (void) pr_table_add(sqlconf_conns, pstrdup(sqlconf_conns_pool, key), conn,
+      sizeof(struct sqlconf_conn *));
+    *((struct sqlconf_conn **) push_array(sqlconf_conn_list)) = conn;
+  }
+
+  h->conn_name = conn->name;
+
+  if (conn->opened == TRUE) {
+    pr_trace_msg(trace_channel, 8, "reusing database connection '%s'",
+      conn->name);
+    return 0;
+  }
+
+  if (sqlconf_open_conn(p, conn->name) < 0) {
+    return -1;
+  }
+
+  conn->opened = TRUE;
+  pr_trace_msg(trace_channel, 8, "opened database connection '%s'",
+    conn->name);
+  return 0;
+}
+
+/* Sets the statement timeout of the named connection, if its database
+ * supports setting one using a SELECT, to the given value, or, if NULL, to
+ * the time left before the deadline.  Returns the previous timeout, or NULL
+ * if none was set.
+ */
+static const char *sqlconf_set_stmt_timeout(pool *p, const char *conn_name,
+    const char *timeout) {
+  cmd_rec *cmd;
+  modret_t *res;
+  sql_data_t *sd;
+  char *query;
+
+  /* MySQL is given its statement timeouts per query, instead; see
+   * sqlconf_dispatch().
+   */
+  if (sqlconf_is_driver(sqlconf_deadline.driver, "postgres") == FALSE) {
+    return NULL;
+  }
+
+  if (timeout == NULL) {
+    char msstr[64];
+
+    memset(msstr, '\0', sizeof(msstr));
+    snprintf(msstr, sizeof(msstr)-1, "%ld", sqlconf_deadline_remaining());
+    timeout = pstrdup(p, msstr);
+  }
+
+  query = pstrcat(p, "current_setting('statement_timeout'), ",
+    "set_config('statement_timeout', '", timeout, "', false)", NULL);
+
+  cmd = sqlconf_cmd_alloc(p, 2, conn_name, query);
+  res = sqlconf_dispatch(cmd, "sql_select");
+  if (MODRET_ISERROR(res)) {
+    destroy_pool(cmd->pool);
+    return NULL;
+  }
+
+  sd = res->data;
+  if (sd->rnum == 0 ||
+      sd->data[0] == NULL) {
+    destroy_pool(cmd->pool);
+    return NULL;
+  }
+
+  pr_trace_msg(trace_channel, 9,
+    "set statement timeout for connection '%s' to %s ms", conn_name,
+    timeout);
+
+  query = pstrdup(p, sd->data[0]);
+  destroy_pool(cmd->pool);
+  return query;
+}
+
+/* Returns the driver of the backend which mod_sql uses when none is given,
+ * if that can be told, i.e. if only one known backend module is loaded.
+ */
+static const char *sqlconf_get_default_driver(void) {
+  register unsigned int i;
+  const char *driver = NULL;
+  static const struct {
+    const char *module_name;
+    const char *driver;
+  } backends[] = {
+    { "mod_sql_mysql.c",	"mysql" },
+    { "mod_sql_postgres.c",	"postgres" },
+    { "mod_sql_sqlite.c",	"sqlite3" },
+    { "mod_sql_odbc.c",		"odbc" },
+    { NULL, NULL }
+  };
+
+  for (i = 0; backends[i].module_name != NULL; i++) {
+    if (pr_module_exists(backends[i].module_name) == FALSE) {
+      continue;
+    }
+
+    if (driver != NULL) {
+      return NULL;
+    }
+
+    driver = backends[i].driver;
+  }
+
+  return driver;
+}
+
+static void sqlconf_start_deadline(sqlconf_handle_t *h, const char *driver) {
+  memset(&sqlconf_deadline, 0, sizeof(sqlconf_deadline));
+
+  if (h->deadline_ms == 0) {
+    return;
+  }
+
+  /* Statement timeouts are set according to the backend used. */
+  if (driver == NULL) {
+    driver = sqlconf_get_default_driver();
+    if (driver == NULL) {
+      pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+        ": unable to tell which database backend is used, setting no "
+        "statement timeouts for deadline_ms; use the driver URI parameter");
+
+    } else {
+      pr_trace_msg(trace_channel, 6,
+        "using '%s' backend statement timeouts for deadline_ms", driver);
+    }
+  }
+
+  gettimeofday(&(sqlconf_deadline.expires), NULL);
+  sqlconf_deadline.expires.tv_sec += h->deadline_ms / 1000;
+  sqlconf_deadline.expires.tv_usec += (h->deadline_ms % 1000) * 1000;
+  if (sqlconf_deadline.expires.tv_usec >= 1000000) {
+    sqlconf_deadline.expires.tv_sec++;
+    sqlconf_deadline.expires.tv_usec -= 1000000;
+  }
+
+  sqlconf_deadline.driver = driver;
+  sqlconf_deadline.active = TRUE;
+}
+
+/* Ends the deadline for the configuration just read, restoring the
+ * connection's statement timeout.  Returns -1, with ETIMEDOUT, if the
+ * deadline passed, i.e. the configuration read is incomplete.
+ */
+static int sqlconf_end_deadline(pool *p) {
+  const char *conn_name, *prev_stmt_timeout;
+  int expired;
+
+  if (sqlconf_deadline.active == FALSE) {
+    return 0;
+  }
+
+  expired = sqlconf_deadline.expired;
+  conn_name = sqlconf_deadline.conn_name;
+  prev_stmt_timeout = sqlconf_deadline.prev_stmt_timeout;
+
+  /* The connection may be used for later URIs, so restore its statement
+   * timeout even (especially) if the deadline passed; the deadline is
+   * cleared first, so that this query is not itself refused.
+   */
+  sqlconf_deadline.active = FALSE;
+
+  if (prev_stmt_timeout != NULL) {
+    (void) sqlconf_set_stmt_timeout(p, conn_name, prev_stmt_timeout);
+  }
+
+  memset(&sqlconf_deadline, 0, sizeof(sqlconf_deadline));
+
+  if (expired == TRUE) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Closes every connection opened during this parse, and cleans up the SQL
+ * subsystem of each backend used.
+ */
+static void sqlconf_close_conns(void) {
+  register unsigned int i;
+  struct sqlconf_conn **conns;
+  const char **drivers;
+  pool *tmp_pool;
+
+  if (sqlconf_conns_pool == NULL) {
+    return;
+  }
+
+  tmp_pool = make_sub_pool(conf_sql_pool);
+  conns = sqlconf_conn_list->elts;
+  drivers = sqlconf_drivers->elts;
+
+  for (i = 0; i < sqlconf_drivers->nelts; i++) {
+    register unsigned int j;
+    cmd_rec *cmd = NULL;
+    modret_t *mr = NULL;
+
+    if (sqlconf_load_backend(tmp_pool, drivers[i]) < 0) {
+      continue;
+    }
+
+    for (j = 0; j < sqlconf_conn_list->nelts; j++) {
+      if (conns[j]->opened == FALSE ||
+          sqlconf_same_driver(conns[j]->driver, drivers[i]) == FALSE) {
+        continue;
+      }
+
+      /* Close the connection. */
+      cmd = sqlconf_cmd_alloc(tmp_pool, 2, conns[j]->name, "1");
+      mr = sqlconf_dispatch(cmd, "sql_close_conn");
+      destroy_pool(cmd->pool);
+      if (MODRET_ISERROR(mr)) {
+        const char *errmsg;
+
+        errmsg = MODRET_ERRMSG(mr);
+        pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+          ": error closing database connection: %s",
+          errmsg ? errmsg : strerror(errno));
+      }
+    }
+
+    /* Cleanup the SQL subsystem. */
+    cmd = sqlconf_cmd_alloc(tmp_pool, 0);
+    mr = sqlconf_dispatch(cmd, "sql_cleanup");
+    destroy_pool(cmd->pool);
+    if (MODRET_ISERROR(mr)) {
+      const char *errmsg;
+
+      errmsg = MODRET_ERRMSG(mr);
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": error cleaning up SQL system: %s",
+        errmsg ? errmsg : strerror(errno));
+    }
+  }
+
+  destroy_pool(tmp_pool);
+
+  destroy_pool(sqlconf_conns_pool);
+  sqlconf_conns_pool = NULL;
+  sqlconf_conns = NULL;
+  sqlconf_conn_list = NULL;
+  sqlconf_drivers = NULL;
+}
+
+/* Generation stamps
+ *
+ * If configured, a single cheap query reads the generation of the database
+ * contents, e.g. a version number bumped whenever the configuration tables
+ * are changed.  If it matches the generation of the last configuration
+ * constructed for the same URI, that configuration is reused, rather than
+ * read from the database again.
+ */
+
+struct sqlconf_generation_row {
+  pool *pool;
+  char *generation;
+};
+
+static int sqlconf_generation_row_cb(char **row, unsigned int fnum,
+    void *user_data) {
+  register unsigned int i;
+  struct sqlconf_generation_row *gen_row;
+
+  gen_row = user_data;
+
+  /* Only the first row is used. */
+  if (gen_row->generation != NULL) {
+    return 0;
+  }
+
+  gen_row->generation = "";
+  for (i = 0; i < fnum; i++) {
+    gen_row->generation = pstrcat(gen_row->pool, gen_row->generation,
+      i > 0 ? "," : "", row[i] ? row[i] : "", NULL);
+  }
+
+  return 0;
+}
+
+static const char *sqlconf_get_generation(sqlconf_handle_t *h, pool *p) {
+  struct sqlconf_generation_row gen_row;
+
+  gen_row.pool = p;
+  gen_row.generation = NULL;
+
+  if (sqlconf_select_rows(h, p, h->generation_query,
+      sqlconf_generation_row_cb, &gen_row) < 0) {
+    int xerrno = errno;
+
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error reading generation: %s", strerror(xerrno));
+
+    errno = xerrno;
+    return NULL;
+  }
+
+  /* No rows, or only NULL values, means an unknown generation. */
+  if (gen_row.generation == NULL ||
+      strspn(gen_row.generation, ",") == strlen(gen_row.generation)) {
+    pr_trace_msg(trace_channel, 3, "no generation found using query '%s'",
+      h->generation_query);
+
+    errno = ENOENT;
+    return NULL;
+  }
+
+  return gen_row.generation;
+}
+
+/* Reuses the last configuration constructed for this handle's URI, either
+ * kept in memory or in the snapshot file, if its generation matches the
+ * current generation.  Returns TRUE if the configuration was reused.
+ */
+static int sqlconf_reuse_generation(sqlconf_handle_t *h, pool *p) {
+  const void *v;
+  char *generation = NULL, *text = NULL;
+  size_t textlen = 0;
+
+  if (h->generation == NULL) {
+    return FALSE;
+  }
+
+  if (sqlconf_generations != NULL) {
+    v = pr_table_get(sqlconf_generations, h->uri, NULL);
+    if (v != NULL) {
+      const struct sqlconf_generation *gen;
+
+      gen = v;
+      if (strcmp(gen->generation, h->generation) == 0) {
+        pr_trace_msg(trace_channel, 6,
+          "generation '%s' unchanged, reusing configuration", h->generation);
+
+        h->conf = sqlconf_buf_create(h->pool, gen->textlen + 1);
+        sqlconf_buf_add(h->conf, gen->text, NULL);
+        h->unchanged = TRUE;
+        return TRUE;
+      }
+
+      pr_trace_msg(trace_channel, 6, "generation changed from '%s' to '%s'",
+        gen->generation, h->generation);
+      return FALSE;
+    }
+  }
+
+  if (h->cache_path == NULL) {
+    return FALSE;
+  }
+
+  if (sqlconf_cache_read(p, h->cache_path, &generation, &text,
+      &textlen) < 0) {
+    pr_trace_msg(trace_channel, 6, "unable to read snapshot '%s': %s",
+      h->cache_path, strerror(errno));
+    return FALSE;
+  }
+
+  if (generation == NULL ||
+      strcmp(generation, h->generation) != 0) {
+    pr_trace_msg(trace_channel, 6,
+      "snapshot '%s' generation '%s' does not match generation '%s'",
+      h->cache_path, generation ? generation : "(none)", h->generation);
+    return FALSE;
+  }
+
+  pr_trace_msg(trace_channel, 6,
+    "generation '%s' unchanged, reusing snapshot '%s'", h->generation,
+    h->cache_path);
+
+  h->conf = sqlconf_buf_create(h->pool, textlen + 1);
+  sqlconf_buf_add(h->conf, text, NULL);
+  h->unchanged = TRUE;
+  return TRUE;
+}
+
+/* Remembers the configuration constructed for this handle's URI, and its
+ * generation, for reuse by later loads.
+ */
+static void sqlconf_remember_generation(sqlconf_handle_t *h) {
+  pool *gen_pool;
+  struct sqlconf_generation *gen;
+  const void *v;
+  const char *text, *key;
+
+  if (h->generation == NULL ||
+      h->lazy == TRUE) {
+    return;
+  }
+
+  if (sqlconf_generations == NULL) {
+    sqlconf_generations = pr_table_alloc(conf_sql_pool, 0);
+  }
+
+  v = pr_table_remove(sqlconf_generations, h->uri, NULL);
+  if (v != NULL) {
+    destroy_pool(((struct sqlconf_generation *) v)->pool);
+  }
+
+  gen_pool = make_sub_pool(conf_sql_pool);
+  pr_pool_tag(gen_pool, "SQL Configuration Generation Pool");
+
+  gen = pcalloc(gen_pool, sizeof(struct sqlconf_generation));
+  gen->pool = gen_pool;
+  gen->generation = pstrdup(gen_pool, h->generation);
+
+  text = sqlconf_buf_get_text(h->conf, &(gen->textlen));
+  gen->text = pstrndup(gen_pool, text, gen->textlen);
+
+  key = pstrdup(gen_pool, h->uri);
+  if (pr_table_add(sqlconf_generations, key, gen,
+      sizeof(struct sqlconf_generation *)) < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error remembering generation '%s': %s", h->generation, strerror(errno));
+    destroy_pool(gen_pool);
+  }
+}
+
+/* Look up the ID of the given base context, or of the "server
+ * config"/default context (i.e. the context whose parent ID is NULL) if no
+ * base context ID is given; if found, the ID is pushed onto the given list.
+ */
+static int sqlconf_find_base(sqlconf_handle_t *h, pool *p, const char *base_id,
+    array_header *bases) {
+  cmd_rec *cmd = NULL;
+  modret_t *res = NULL;
+  sql_data_t *sd = NULL;
+  char *where, *which_id = NULL;
+
+  if (base_id == NULL) {
+    where = pstrcat(p, h->ctxs.parent_id_col, " IS NULL", NULL);
+    which_id = "default";
+
+  } else {
+    where = pstrcat(p, h->ctxs.id_col, " = ", base_id, NULL);
+    which_id = "base";
+  }
+
+  cmd = sqlconf_cmd_alloc(p, 4, h->conn_name, h->ctxs.table,
+    h->ctxs.id_col, where);
+
+  res = sqlconf_dispatch(cmd, "sql_select");
+  if (MODRET_ISERROR(res)) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error retrieving %s context ID", which_id);
+
+    destroy_pool(cmd->pool);
+    errno = ENOENT;
+    return -1;
+  }
+
+  sd = res->data;
+
+  /* We only want _one_ unique base context.  Any more than that is a
+   * configuration error in the database.
+   *
+   * However, if there is NO unique base context, then we ASSUME that the
+   * configuration data is empty, akin to an empty config file.
+   */
+  if (sd->rnum != 0 &&
+      sd->fnum != 0) {
+    if (sd->rnum != 1 &&
+        sd->fnum != 1) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": retrieving %s context failed: bad/non-unique results", which_id);
+
+      destroy_pool(cmd->pool);
+      errno = ENOENT;
+      return -1;
+    }
+
+    if (sd->data == NULL ||
+        sd->data[0] == NULL) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": retrieving %s context failed: no matching results", which_id);
+
+      destroy_pool(cmd->pool);
+      errno = ENOENT;
+      return -1;
+    }
+  }
+
+  if (sd->rnum == 1 &&
+      sd->fnum == 1) {
+    *((int *) push_array(bases)) = atoi(sd->data[0]);
+  }
+
+  destroy_pool(cmd->pool);
+  return 0;
+}
+
+/* Base context names
+ */
+
+struct sqlconf_name_rows {
+  pool *pool;
+
+  /* The (id, name) rows read, in ID order. */
+  array_header *ids;
+  array_header *names;
+};
+
+static int sqlconf_name_row_cb(char **row, unsigned int fnum,
+    void *user_data) {
+  struct sqlconf_name_rows *rows;
+
+  rows = user_data;
+
+  if (fnum < 2 ||
+      row[0] == NULL ||
+      *row[0] == '\0') {
+    return 0;
+  }
+
+  *((char **) push_array(rows->ids)) = pstrdup(rows->pool, row[0]);
+  *((char **) push_array(rows->names)) = pstrdup(rows->pool,
+    row[1] ? row[1] : "");
+  return 0;
+}
+
+/* Returns the predicate on the name column for the given listed name: an
+ * equality comparison, or, for a name ending in '*', a prefix LIKE, both of
+ * which can use an index on that column.
+ */
+static char *sqlconf_get_name_clause(sqlconf_handle_t *h, pool *p,
+    const char *name) {
+  cmd_rec *cmd;
+  modret_t *res;
+  size_t namelen;
+  int prefix;
+  char *text, *escaped, *esc = "";
+
+  namelen = strlen(name);
+  prefix = (namelen > 0 && name[namelen-1] == '*');
+
+  if (prefix == FALSE) {
+    text = pstrdup(p, name);
+
+  } else {
+    register unsigned int i;
+    char *ptr;
+
+    /* Escape any LIKE wildcards in the prefix itself. */
+    text = ptr = pcalloc(p, (namelen * 2) + 1);
+    for (i = 0; i < namelen - 1; i++) {
+      if (name[i] == '%' ||
+          name[i] == '_' ||
+          name[i] == '!') {
+        *ptr++ = '!';
+        esc = " ESCAPE '!'";
+      }
+
+      *ptr++ = name[i];
+    }
+
+    *ptr = '%';
+  }
+
+  cmd = sqlconf_cmd_alloc(p, 2, h->conn_name, text);
+  res = sqlconf_dispatch(cmd, "sql_escapestr");
+  if (MODRET_ISERROR(res) ||
+      res->data == NULL) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error escaping base context name '%s'", name);
+
+    destroy_pool(cmd->pool);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  escaped = pstrdup(p, res->data);
+  destroy_pool(cmd->pool);
+
+  if (prefix == TRUE) {
+    return pstrcat(p, h->ctxs.name_col, " LIKE '", escaped, "'", esc, NULL);
+  }
+
+  return pstrcat(p, h->ctxs.name_col, " = '", escaped, "'", NULL);
+}
+
+/* Whether the given name matches the given listed name, for ordering the
+ * rows read.  The database may compare names case-insensitively, so do the
+ * same here.
+ */
+static int sqlconf_match_name(const char *pattern, const char *name) {
+  size_t len;
+
+  len = strlen(pattern);
+  if (len > 0 &&
+      pattern[len-1] == '*') {
+    return strncasecmp(pattern, name, len - 1) == 0;
+  }
+
+  return strcasecmp(pattern, name) == 0;
+}
+
+/* Resolves the listed base context names to their IDs, using a single query,
+ * so that the rest of the read proceeds as for a list of base IDs.  Contexts
+ * are listed in the order of the names which match them, and for a prefix,
+ * in ID order; each context is listed once.  Any other rows the database
+ * matched (e.g. due to its collation) follow, in ID order.
+ */
+static int sqlconf_resolve_base_names(sqlconf_handle_t *h, pool *p) {
+  register unsigned int i, j;
+  struct sqlconf_name_rows rows;
+  pr_table_t *seen;
+  char **names, **ids, **row_names, *query, *clauses = NULL;
+  int res;
+
+  names = h->ctxs.base_names->elts;
+  for (i = 0; i < h->ctxs.base_names->nelts; i++) {
+    char *clause;
+
+    clause = sqlconf_get_name_clause(h, p, names[i]);
+    if (clause == NULL) {
+      return -1;
+    }
+
+    clauses = pstrcat(p, clauses ? clauses : "", clauses ? " OR " : "",
+      clause, NULL);
+  }
+
+  query = pstrcat(p, h->ctxs.id_col, ", ", h->ctxs.name_col, " FROM ",
+    h->ctxs.table, " WHERE (", clauses, ")", NULL);
+  if (h->ctxs.where != NULL) {
+    query = pstrcat(p, query, " AND ", h->ctxs.where, NULL);
+  }
+  query = pstrcat(p, query, " ORDER BY ", h->ctxs.id_col, NULL);
+
+  rows.pool = p;
+  rows.ids = make_array(p, 1, sizeof(char *));
+  rows.names = make_array(p, 1, sizeof(char *));
+
+  res = sqlconf_select_rows(h, p, query, sqlconf_name_row_cb, &rows);
+  if (res < 0) {
+    int xerrno = errno;
+
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error resolving base context names: %s", strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  h->ctxs.base_ids = make_array(p, rows.ids->nelts + 1, sizeof(char *));
+  seen = pr_table_nalloc(p, 0, 256);
+  if (rows.ids->nelts > 0) {
+    unsigned int max_ents;
+
+    /* Tables have a default limit on the number of entries they hold. */
+    max_ents = rows.ids->nelts;
+    (void) pr_table_ctl(seen, PR_TABLE_CTL_SET_MAX_ENTS, &max_ents);
+  }
+
+  ids = rows.ids->elts;
+  row_names = rows.names->elts;
+
+  for (i = 0; i <= h->ctxs.base_names->nelts; i++) {
+    for (j = 0; j < rows.ids->nelts; j++) {
+      if ((i < h->ctxs.base_names->nelts &&
+           sqlconf_match_name(names[i], row_names[j]) == FALSE) ||
+          pr_table_exists(seen, ids[j]) > 0) {
+        continue;
+      }
+
+      (void) pr_table_add(seen, ids[j], "", 1);
+      *((char **) push_array(h->ctxs.base_ids)) = ids[j];
+    }
+  }
+
+  pr_trace_msg(trace_channel, 8, "resolved base_name to %u context IDs",
+    h->ctxs.base_ids->nelts);
+  return 0;
+}
+
+/* Construct the configuration file from the database contents. */
+static int sqlconf_read_db(sqlconf_handle_t *h, pool *p, char *driver) {
+  array_header *bases;
+
+  if (pr_module_exists("mod_sql.c") == FALSE) {
+    pr_log_pri(PR_LOG_NOTICE, MOD_CONF_SQL_VERSION
+      ": missing required mod_sql; module not built/loaded");
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (sqlconf_open_db(h, p, driver) < 0) {
+    return -1;
+  }
+
+  if (sqlconf_deadline.active == TRUE) {
+    sqlconf_deadline.conn_name = h->conn_name;
+    sqlconf_deadline.prev_stmt_timeout = sqlconf_set_stmt_timeout(p,
+      h->conn_name, NULL);
+  }
+
+  if (h->generation_query != NULL) {
+    /* If the generation cannot be read, construct the configuration anyway;
+     * it will simply not be reused.
+     */
+    h->generation = sqlconf_get_generation(h, p);
+
+    if (sqlconf_reuse_generation(h, p) == TRUE) {
+      return 0;
+    }
+  }
+
+  if (h->ctxs.base_names != NULL) {
+    if (sqlconf_resolve_base_names(h, p) < 0) {
+      return -1;
+    }
+
+    /* No matching names is akin to an empty config file. */
+    if (h->ctxs.base_ids->nelts == 0) {
+      pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+        ": no contexts found matching base_name");
+      h->conf = sqlconf_buf_create(h->pool, 0);
+      return 0;
+    }
+  }
+
+  if (h->strategy != CONF_SQL_STRATEGY_WALK) {
+    pool *tmp_pool;
+    int res, xerrno;
+
+    /* The tables read are only needed until their text is rendered (unless
+     * kept for later URIs, in their own pool); release them then, rather
+     * than holding them until this "file" is closed.
+     */
+    tmp_pool = make_sub_pool(p);
+    pr_pool_tag(tmp_pool, "SQL Configuration Load Pool");
+
+    res = sqlconf_read_tree(h, tmp_pool);
+    xerrno = errno;
+
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return res;
+  }
+
+  /* Do the database digging. To start things off, we need to find the
+   * "server config"/default context, or each of the base contexts we have
+   * been given.
+   */
+  bases = make_array(p, 1, sizeof(int));
+
+  if (h->ctxs.base_ids == NULL) {
+    if (sqlconf_find_base(h, p, NULL, bases) < 0) {
+      return -1;
+    }
+
+  } else {
+    register unsigned int i;
+    char **base_ids;
+
+    base_ids = h->ctxs.base_ids->elts;
+    for (i = 0; i < h->ctxs.base_ids->nelts; i++) {
+      if (sqlconf_find_base(h, p, base_ids[i], bases) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  h->conf = sqlconf_buf_create(h->pool, 0);
+  if (bases->nelts > 0 &&
+      h->lazy == TRUE) {
+    sqlconf_make_walk_queries(h, p);
+
+    h->frames = make_array(p, 8, sizeof(struct sqlconf_frame *));
+    if (sqlconf_push_bases_frame(h, bases) < 0) {
+      int xerrno = errno;
+
+      h->frames = NULL;
+      h->conf = NULL;
+      errno = xerrno;
+      return -1;
+    }
+
+    if (h->prefetch == TRUE) {
+      sqlconf_start_prefetch(h);
+      sqlconf_prefetch_next_ctx(h);
+    }
+
+    /* The connection stays open; the rest of the walk happens as the text
+     * is read.
+     */
+    return 0;
+  }
+
+  if (bases->nelts > 0) {
+    register unsigned int i;
+    pool *tmp_pool;
+
+    /* As for the other strategies, everything but the text is released
+     * once the walk is done.
+     */
+    tmp_pool = make_sub_pool(p);
+    pr_pool_tag(tmp_pool, "SQL Configuration Load Pool");
+
+    /* When reading the whole configuration, rather than base contexts, read
+     * every directive using a single query, rather than one query per
+     * context.
+     */
+    if (h->ctxs.base_ids == NULL) {
+      h->conf_tree = sqlconf_tree_create(tmp_pool);
+
+      if (sqlconf_select_tree_confs(h, tmp_pool, h->conf_tree,
+          sqlconf_get_confs_query(h, tmp_pool, NULL)) < 0) {
+        int xerrno = errno;
+
+        destroy_pool(tmp_pool);
+        h->conf_tree = NULL;
+        h->conf = NULL;
+        errno = xerrno;
+        return -1;
+      }
+    }
+
+    sqlconf_make_walk_queries(h, tmp_pool);
+
+    if (h->workers > 1) {
+      sqlconf_read_workers(h, tmp_pool, bases);
+
+    } else {
+      for (i = 0; i < bases->nelts; i++) {
+        sqlconf_read_ctx(h, tmp_pool, ((int *) bases->elts)[i], TRUE, 0);
+      }
+    }
+
+    h->conf_tree = NULL;
+    h->ctx_query = h->ctx_ctxs_query = h->conf_query = NULL;
+    destroy_pool(tmp_pool);
+  }
+
+  return 0;
+}
+
+/* Ends any in-progress lazy walk.  Its database connection stays open, for
+ * other handles, until the end of the parse.
+ */
+static void sqlconf_end_frames(sqlconf_handle_t *h) {
+  if (h->frames == NULL) {
+    return;
+  }
+
+  sqlconf_stop_prefetch(h);
+
+  h->frames = NULL;
+  h->ctx_query = h->ctx_ctxs_query = h->conf_query = NULL;
+}
+
+/* Snapshot cache
+ */
+
+static void sqlconf_write_cache(sqlconf_handle_t *h, pool *p) {
+  const char *text;
+  size_t textlen = 0;
+
+  if (h->cache_path == NULL) {
+    return;
+  }
+
+  /* A lazily generated configuration is never held in full. */
+  if (h->lazy == TRUE) {
+    pr_trace_msg(trace_channel, 6,
+      "not writing snapshot '%s' for lazily generated configuration",
+      h->cache_path);
+    return;
+  }
+
+  text = sqlconf_buf_get_text(h->conf, &textlen);
+  if (sqlconf_cache_write(p, h->cache_path, h->generation, text,
+      textlen) < 0) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error writing snapshot '%s': %s", h->cache_path, strerror(errno));
+  }
+}
+
+static int sqlconf_read_cache(sqlconf_handle_t *h, pool *p) {
+  char *generation = NULL, *text = NULL;
+  size_t textlen = 0;
+
+  if (h->cache_path == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (sqlconf_cache_read(p, h->cache_path, &generation, &text,
+      &textlen) < 0) {
+    int xerrno = errno;
+
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error reading snapshot '%s': %s", h->cache_path, strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  h->generation = generation;
+  h->conf = sqlconf_buf_create(p, textlen + 1);
+  sqlconf_buf_add(h->conf, text, NULL);
+
+  return 0;
+}
+
+/* A helper process, reading the configuration on behalf of the process
+ * which started it, must neither use nor close that process's connections,
+ * which may still be in use; it opens its own, named using the given prefix.
+ */
+static void sqlconf_use_own_conns(const char *prefix) {
+  sqlconf_conn_prefix = prefix;
+
+  if (sqlconf_conns_pool != NULL) {
+    sqlconf_conns_pool = make_sub_pool(conf_sql_pool);
+    sqlconf_conns = pr_table_alloc(sqlconf_conns_pool, 0);
+    sqlconf_conn_list = make_array(sqlconf_conns_pool, 1,
+      sizeof(struct sqlconf_conn *));
+  }
+}
 
-  if (sqlconf_ctxs.where == NULL) {
-    where = pstrcat(p, sqlconf_ctxs.id_col, " = ", idstr, NULL);
+/* Closes the connections opened by a helper process. */
+static void sqlconf_close_own_conns(pool *p) {
+  register unsigned int i;
+  struct sqlconf_conn **conns;
 
-  } else {
-    where = pstrcat(p, sqlconf_ctxs.id_col, " = ", idstr, " AND ",
-      sqlconf_ctxs.where, NULL);
+  if (sqlconf_conn_list == NULL) {
+    return;
   }
 
-  cmd = sqlconf_cmd_alloc(p, 4, "sqlconf", sqlconf_ctxs.table,
-    pstrcat(p, sqlconf_ctxs.type_col, ", ", sqlconf_ctxs.value_col, NULL),
-    where);
+  conns = sqlconf_conn_list->elts;
+  for (i = 0; i < sqlconf_conn_list->nelts; i++) {
+    cmd_rec *cmd;
 
-  res = sqlconf_dispatch(cmd, "sql_select");
-  if (MODRET_ISERROR(res)) {
-    pr_log_debug(DEBUG4, MOD_CONF_SQL_VERSION
-      ": notice: context ID (%d) has no associated key/value", ctx_id);
-    errno = ENOENT;
-    return -1;
+    if (conns[i]->opened == FALSE) {
+      continue;
+    }
+
+    cmd = sqlconf_cmd_alloc(p, 2, conns[i]->name, "1");
+    (void) sqlconf_dispatch(cmd, "sql_close_conn");
+    destroy_pool(cmd->pool);
   }
+}
 
-  sd = res->data;
+/* Reading within a deadline: the configuration is read by a helper process,
+ * so that the read can be abandoned once the deadline passes, even while the
+ * helper is blocked, e.g. connecting to an unreachable database.  One helper
+ * is kept for the whole parse, and handed the URI of each sql:// file in
+ * turn, so that its connection, and any tables read by the bulk strategy,
+ * are shared by later URIs, as they would be without a deadline.  The helper
+ * sends back whether the configuration is unchanged, its generation, and its
+ * text, as "U|C<generation>\n<text>".
+ */
+static sqlconf_workers_t *sqlconf_deadline_helper = NULL;
 
-  if (sd->rnum > 1) {
-    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-      ": error: multiple key/values returned for given context ID (%d)",
-      ctx_id);
-    errno = EINVAL;
-    return -1;
-  }
+static int sqlconf_deadline_init_cb(pool *p, unsigned int worker,
+    void *user_data) {
+  sqlconf_use_own_conns("sqlconf-deadline");
+  return 0;
+}
 
-  ctx_key = sd->data[0];
-  if (sd->fnum > 1) {
-    size_t len;
+static int sqlconf_deadline_item_cb(pool *p, unsigned int item,
+    const char *data, sqlconf_buf_t *buf, void *user_data) {
+  sqlconf_handle_t *h;
+  const char *generation, *text = "";
+  char *driver = NULL;
+  int res, tracing = FALSE;
 
-    ctx_val = sd->data[1];
-    len = strlen(ctx_val);
-    if (len == 0) {
-      ctx_val = NULL;
-    }
+  h = pcalloc(p, sizeof(sqlconf_handle_t));
+  h->pool = p;
+  h->uri = pstrdup(p, data);
+
+  if (sqlconf_parse_uri(h, p, pstrdup(p, data), &driver, &tracing) < 0) {
+    return -1;
   }
 
-  if (ctx_key != NULL &&
-      !isbase) {
-    *((char **) push_array(sqlconf_conf)) = pstrcat(sqlconf_conf_pool, "<",
-      ctx_key, ctx_val ? " " : "", ctx_val ? ctx_val : "", ">\n", NULL);
+  sqlconf_start_deadline(h, driver);
+
+  res = sqlconf_read_db(h, p, driver);
+  if (sqlconf_end_deadline(p) < 0) {
+    res = -1;
   }
 
-  if (sqlconf_read_conf(p, ctx_id) < 0) {
+  if (res < 0) {
     return -1;
   }
 
-  if (sqlconf_read_ctx_ctxs(p, ctx_id) < 0) {
-    return -1;
+  if (h->conf != NULL) {
+    text = sqlconf_buf_get_text(h->conf, NULL);
   }
 
-  if (ctx_key != NULL &&
-      !isbase) {
-    *((char **) push_array(sqlconf_conf)) = pstrcat(sqlconf_conf_pool, "</",
-      ctx_key, ">\n", NULL);
+  /* A generation spanning lines cannot be sent back; it is then simply not
+   * known.
+   */
+  generation = h->generation;
+  if (generation != NULL &&
+      strchr(generation, '\n') != NULL) {
+    generation = NULL;
   }
 
+  sqlconf_buf_add(buf, h->unchanged ? "U" : "C",
+    generation ? generation : "", "\n", text, NULL);
   return 0;
 }
 
-static int sqlconf_close_db(pool *p) {
-  int res = 0, xerrno = 0;
-  cmd_rec *cmd = NULL;
-  modret_t *mr = NULL;
-
-  /* Close the connection. */
-  cmd = sqlconf_cmd_alloc(p, 2, "sqlconf", "1");
-  mr = sqlconf_dispatch(cmd, "sql_close_conn");
-  destroy_pool(cmd->pool);
-  if (MODRET_ISERROR(mr)) {
-    const char *errmsg;
-
-    errmsg = MODRET_ERRMSG(mr);
-    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-      ": error closing database connection: %s",
-      errmsg ? errmsg : strerror(errno));
+static void sqlconf_deadline_exit_cb(pool *p, unsigned int worker,
+    void *user_data) {
+  sqlconf_close_own_conns(p);
+}
 
-    xerrno = EINVAL;
-    res = -1;
+static void sqlconf_stop_deadline_helper(void) {
+  if (sqlconf_deadline_helper == NULL) {
+    return;
   }
 
-  if (res == 0) {
-    /* Cleanup the SQL subsystem. */
-    cmd = sqlconf_cmd_alloc(p, 0);
-    mr = sqlconf_dispatch(cmd, "sql_cleanup");
-    destroy_pool(cmd->pool);
-    if (MODRET_ISERROR(mr)) {
-      const char *errmsg;
+  (void) sqlconf_workers_stop(sqlconf_deadline_helper);
+  sqlconf_deadline_helper = NULL;
+}
 
-      errmsg = MODRET_ERRMSG(mr);
-      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-        ": error cleaning up SQL system: %s",
-        errmsg ? errmsg : strerror(errno));
+static int sqlconf_read_db_deadline(sqlconf_handle_t *h, pool *p,
+    char *driver) {
+  unsigned int item;
+  const char *text = NULL, *ptr = NULL;
+  size_t textlen = 0;
+  long remaining;
+  int res, xerrno;
 
-      xerrno = EINVAL;
-      res = -1;
+  if (sqlconf_deadline_helper == NULL) {
+    sqlconf_deadline_helper = sqlconf_workers_start(conf_sql_pool, 1,
+      sqlconf_deadline_init_cb, sqlconf_deadline_item_cb,
+      sqlconf_deadline_exit_cb, NULL);
+    if (sqlconf_deadline_helper == NULL) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": error starting helper for deadline_ms (%s), reading configuration "
+        "directly", strerror(errno));
+      return sqlconf_read_db(h, p, driver);
     }
   }
 
-  errno = xerrno;
-  return res;
-}
+  /* The versions kept for the URI are the helper's, and so are gone once
+   * the parse is done; say so, since every context is then read again on
+   * every restart.
+   */
+  if (h->ctxs.version_col != NULL) {
+    pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+      ": versions are not kept across restarts when using deadline_ms, "
+      "reading every context");
+  }
 
-/* Construct the configuration file from the database contents. */
-static int sqlconf_read_db(pool *p, char *driver) {
-  int id = 0;
-  cmd_rec *cmd = NULL;
-  modret_t *res = NULL;
-  sql_data_t *sd = NULL;
-  const char *username, *password, *dsn;
-  char *where, *which_id = NULL;
+  remaining = sqlconf_deadline_remaining();
+  (void) sqlconf_workers_set_timeout(sqlconf_deadline_helper,
+    remaining > 0 ? (unsigned int) remaining : 0);
+  (void) sqlconf_workers_submit(sqlconf_deadline_helper, 0, h->uri);
 
-  if (pr_module_exists("mod_sql.c") == FALSE) {
-    pr_log_pri(PR_LOG_NOTICE, MOD_CONF_SQL_VERSION
-      ": missing required mod_sql; module not built/loaded");
-    errno = ENOENT;
-    return -1;
-  }
+  res = sqlconf_workers_next(sqlconf_deadline_helper, &item, &text, &textlen);
+  xerrno = errno;
 
-  /* Load the SQL backend module we'll be using. */
-  if (driver == NULL) {
-    cmd = sqlconf_cmd_alloc(p, 0);
+  if (res == 1) {
+    ptr = memchr(text, '\n', textlen);
+    if (ptr == NULL) {
+      pr_trace_msg(trace_channel, 3, "deadline helper sent malformed text");
+      res = -1;
+      xerrno = EINVAL;
+    }
+  }
 
-  } else {
-    /* The mod_sql_sqlite module uses a backend name of "sqlite3"; check
-     * the driver name to see if that what was intended.
-     */
-    if (strcasecmp(driver, "sqlite") == 0) {
-      driver = pstrdup(p, "sqlite3");
+  if (res == 1) {
+    h->unchanged = (text[0] == 'U');
+    if (ptr > text + 1) {
+      h->generation = pstrndup(h->pool, text + 1, ptr - text - 1);
     }
 
-    cmd = sqlconf_cmd_alloc(p, 1, driver);
+    h->conf = sqlconf_buf_create(h->pool, textlen - (ptr - text));
+    sqlconf_buf_add(h->conf, ptr + 1, NULL);
+    return 0;
   }
 
-  res = sqlconf_dispatch(cmd, "sql_load_backend");
-  destroy_pool(cmd->pool);
-  if (MODRET_ISERROR(res)) {
-    int xerrno = errno;
-    const char *errmsg;
+  /* A helper which failed, or ran out of time, is not used again; the next
+   * URI starts another.
+   */
+  sqlconf_stop_deadline_helper();
 
-    errmsg = MODRET_ERRMSG(res);
+  if (xerrno == ETIMEDOUT ||
+      sqlconf_deadline_remaining() <= 0) {
     pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-      ": error loading database backend: %s",
-      errmsg ? errmsg : strerror(xerrno));
-
-    errno = xerrno;
-    return -1;
+      ": configuration not read within %u ms, abandoning helper",
+      h->deadline_ms);
+    sqlconf_deadline.expired = TRUE;
+    xerrno = ETIMEDOUT;
   }
 
-  /* Prepare the SQL subsystem. */
-  cmd = sqlconf_cmd_alloc(p, 1, make_sub_pool(p));
-  res = sqlconf_dispatch(cmd, "sql_prepare");
-  destroy_pool(cmd->pool);
-  if (MODRET_ISERROR(res)) {
-    const char *errmsg;
+  errno = xerrno;
+  return -1;
+}
 
-    errmsg = MODRET_ERRMSG(res);
-    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-      ": error preparing database backend: %s",
-      errmsg ? errmsg : strerror(errno));
+/* Stale-while-revalidate: the snapshot is used as is, without waiting on
+ * the database, while a helper process reads the configuration from the
+ * database in the background, and rewrites the snapshot if it has changed.
+ * The new configuration is then used on the next restart, which the helper
+ * can trigger itself, by signalling the process which started it.
+ */
+/* Whether the helper last started for the given snapshot is still running. */
+static int sqlconf_is_revalidating(const char *cache_path) {
+  struct sqlconf_revalidation *helper;
+  int status;
 
-    errno = EINVAL;
-    return -1;
+  if (sqlconf_revalidations == NULL) {
+    return FALSE;
   }
 
-  /* Define the connection we'll be making.
-   *
-   * IFF we have a username, password, AND database, we assume we need to
-   * use a DSN formatted for a network-connected database.
-   */
-  username = sqlconf_db.username;
-  password = sqlconf_db.password;
-  if (sqlconf_db.username != NULL &&
-      sqlconf_db.password != NULL &&
-      sqlconf_db.database != NULL) {
-    dsn = pstrcat(p, sqlconf_db.database, "@", sqlconf_db.server, NULL);
+  helper = (struct sqlconf_revalidation *) pr_table_get(sqlconf_revalidations,
+    cache_path, NULL);
+  if (helper == NULL ||
+      helper->pid <= 0) {
+    return FALSE;
+  }
 
-  } else {
-    dsn = sqlconf_db.server;
+  /* The helper may already have been reaped by someone else, e.g. the
+   * daemon's own handling of SIGCHLD.
+   */
+  if (waitpid(helper->pid, &status, WNOHANG) == 0) {
+    return TRUE;
   }
 
-  cmd = sqlconf_cmd_alloc(p, 4, "sqlconf", username, password, dsn);
-  res = sqlconf_dispatch(cmd, "sql_define_conn");
-  destroy_pool(cmd->pool);
-  if (MODRET_ISERROR(res)) {
-    const char *errmsg;
+  helper->pid = -1;
+  return FALSE;
+}
 
-    errmsg = MODRET_ERRMSG(res);
-    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-      ": error defining database connection: %s",
-      errmsg ? errmsg : strerror(errno));
+static void sqlconf_add_revalidation(const char *cache_path, pid_t pid) {
+  struct sqlconf_revalidation *helper = NULL;
 
-    errno = EINVAL;
-    return -1;
+  if (sqlconf_revalidations == NULL) {
+    sqlconf_revalidations = pr_table_alloc(conf_sql_pool, 0);
+
+  } else {
+    helper = (struct sqlconf_revalidation *) pr_table_get(
+      sqlconf_revalidations, cache_path, NULL);
   }
 
-  /* Open a connection to the database. */
-  cmd = sqlconf_cmd_alloc(p, 1, "sqlconf");
-  res = sqlconf_dispatch(cmd, "sql_open_conn");
-  destroy_pool(cmd->pool);
-  if (MODRET_ISERROR(res)) {
-    const char *errmsg;
+  if (helper == NULL) {
+    helper = pcalloc(conf_sql_pool, sizeof(struct sqlconf_revalidation));
+    if (pr_table_add(sqlconf_revalidations, pstrdup(conf_sql_pool,
+        cache_path), helper, sizeof(struct sqlconf_revalidation *)) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error tracking revalidation helper for snapshot '%s': %s",
+        cache_path, strerror(errno));
+      return;
+    }
+  }
 
-    errmsg = MODRET_ERRMSG(res);
-    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-      ": error opening database connection: %s",
-      errmsg ? errmsg : strerror(errno));
+  helper->pid = pid;
+}
 
-    errno = EINVAL;
-    return -1;
-  }
+static void sqlconf_revalidate(sqlconf_handle_t *h, pool *p, char *driver) {
+  const char *prev_text, *text;
+  const char *prev_generation;
+  size_t prev_textlen = 0, textlen = 0;
+  pid_t pid, parent_pid;
+  unsigned int limit_secs;
+  int changed, res;
 
-  /* Do the database digging. To start things off, we need to find the
-   * "server config"/default context.  If we've been given a base context,
-   * look for the ID of the context with that name, otherwise, look for the
-   * context whose ID is NULL.
+  /* With the database slow or unreachable, helpers would otherwise pile up,
+   * one per restart.
    */
-  if (sqlconf_ctxs.base_id == NULL) {
-    where = pstrcat(p, sqlconf_ctxs.parent_id_col, " IS NULL", NULL);
-    which_id = "default";
-
-  } else {
-    where = pstrcat(p, sqlconf_ctxs.id_col, " = ", sqlconf_ctxs.base_id, NULL);
-    which_id = "base";
+  if (sqlconf_is_revalidating(h->cache_path) == TRUE) {
+    pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+      ": snapshot '%s' is still being revalidated, not starting another "
+      "helper", h->cache_path);
+    return;
   }
 
-  cmd = sqlconf_cmd_alloc(p, 4, "sqlconf", sqlconf_ctxs.table,
-    sqlconf_ctxs.id_col, where);
+  parent_pid = getpid();
 
-  res = sqlconf_dispatch(cmd, "sql_select");
-  if (MODRET_ISERROR(res)) {
+  pid = fork();
+  if (pid < 0) {
     pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-      ": error retrieving %s context ID", which_id);
+      ": error starting revalidation helper for snapshot '%s': %s",
+      h->cache_path, strerror(errno));
+    return;
+  }
 
-    (void) sqlconf_close_db(p);
-    errno = ENOENT;
-    return -1;
+  if (pid > 0) {
+    pr_trace_msg(trace_channel, 6,
+      "started revalidation helper (PID %lu) for snapshot '%s'",
+      (unsigned long) pid, h->cache_path);
+    sqlconf_add_revalidation(h->cache_path, pid);
+    return;
   }
 
-  sd = res->data;
+  prev_text = sqlconf_buf_get_text(h->conf, &prev_textlen);
+  prev_generation = h->generation;
 
-  /* We only want _one_ unique base context.  Any more than that is a
-   * configuration error in the database.
-   *
-   * However, if there is NO unique base context, then we ASSUME that the
-   * configuration data is empty, akin to an empty config file.
+  sqlconf_workers_detach();
+  sqlconf_use_own_conns("sqlconf-revalidate");
+
+  h->conf = NULL;
+  h->generation = NULL;
+
+  /* However long the database takes, e.g. to connect, the helper is killed
+   * once deadline_ms (or, without it, a default limit) has passed; the
+   * deadline also sets statement timeouts, as for any other read.
    */
-  if (sd->rnum != 0 &&
-      sd->fnum != 0) {
-    if (sd->rnum != 1 &&
-        sd->fnum != 1) {
-      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-        ": retrieving %s context failed: bad/non-unique results", which_id);
+  limit_secs = h->deadline_ms > 0 ? (h->deadline_ms + 999) / 1000 :
+    CONF_SQL_DEFAULT_REVALIDATE_SECS;
+  (void) signal(SIGALRM, SIG_DFL);
+  (void) alarm(limit_secs);
 
-      (void) sqlconf_close_db(p);
-      errno = ENOENT;
-      return -1;
-    }
+  sqlconf_start_deadline(h, driver);
 
-    if (sd->data == NULL ||
-        sd->data[0] == NULL) {
-      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
-        ": retrieving %s context failed: no matching results", which_id);
+  res = sqlconf_read_db(h, p, driver);
+  if (sqlconf_end_deadline(p) < 0) {
+    res = -1;
+  }
 
-      (void) sqlconf_close_db(p);
-      errno = ENOENT;
-      return -1;
+  if (res < 0) {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": error revalidating snapshot '%s': %s", h->cache_path,
+      strerror(errno));
+    _exit(1);
+  }
+
+  changed = FALSE;
+  if (h->unchanged == FALSE) {
+    text = sqlconf_buf_get_text(h->conf, &textlen);
+    if (textlen != prev_textlen ||
+        memcmp(text, prev_text, textlen) != 0) {
+      changed = TRUE;
     }
 
-    id = atoi(sd->data[0]);
+    /* Keep the snapshot's generation current, even if its text is not
+     * changed, so that the next check can be skipped.
+     */
+    if (changed == TRUE ||
+        (h->generation != NULL &&
+         (prev_generation == NULL ||
+          strcmp(h->generation, prev_generation) != 0))) {
+      sqlconf_write_cache(h, p);
+    }
   }
 
-  destroy_pool(cmd->pool);
+  if (changed == TRUE) {
+    pr_log_pri(PR_LOG_NOTICE, MOD_CONF_SQL_VERSION
+      ": configuration in database differs from snapshot '%s'; snapshot "
+      "rewritten, for use on the next restart", h->cache_path);
 
-  sqlconf_conf = make_array(p, 1, sizeof(char *));
-  if (sd->rnum == 1 &&
-      sd->fnum == 1) {
-    sqlconf_read_ctx(p, id, TRUE);
-  }
+    if (h->revalidate_hup == TRUE) {
+      /* The process which started us may since have exited, e.g. when
+       * daemonizing at startup, in which case there is no one to signal.
+       */
+      if (getppid() == parent_pid) {
+        pr_log_pri(PR_LOG_NOTICE, MOD_CONF_SQL_VERSION
+          ": signalling process %lu to restart", (unsigned long) parent_pid);
+        (void) kill(parent_pid, SIGHUP);
+
+      } else {
+        pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+          ": process %lu has exited, not signalling restart",
+          (unsigned long) parent_pid);
+      }
+    }
 
-  if (sqlconf_close_db(p) < 0) {
-    return -1;
+  } else {
+    pr_trace_msg(trace_channel, 6, "snapshot '%s' is current",
+      h->cache_path);
   }
 
-  return 0;
+  sqlconf_close_own_conns(p);
+
+  /* As for workers, exit without running any of the parent's exit
+   * handlers.
+   */
+  _exit(0);
 }
 
 /* FSIO callbacks
@@ -884,23 +4547,89 @@ static int sqlconf_fsio_open(pr_fh_t *fh, const char *path, int flags) {
   if (strncmp(CONF_SQL_URI_PREFIX, path, CONF_SQL_URI_PREFIX_LEN) == 0) {
     pool *p;
     char *driver = NULL, *uri;
+    sqlconf_handle_t *h;
+    int res, xerrno;
 
-    sqlconf_conf_pool = make_sub_pool(conf_sql_pool);
-    pr_pool_tag(sqlconf_conf_pool, "SQL Configuration Pool");
+    p = make_sub_pool(conf_sql_pool);
+    pr_pool_tag(p, "SQL Configuration Pool");
+
+    h = pcalloc(p, sizeof(sqlconf_handle_t));
+    h->pool = p;
 
-    p = sqlconf_conf_pool;
     uri = pstrdup(p, path);
+    h->uri = pstrdup(p, path);
 
     /* Parse through the given URI, breaking out the needed pieces. */
-    if (sqlconf_parse_uri(p, uri, &driver, &use_tracing) < 0) {
+    if (sqlconf_parse_uri(h, p, uri, &driver, &use_tracing) < 0) {
+      int xerrno = errno;
+
+      destroy_pool(p);
+      errno = xerrno;
       return -1;
     }
 
-    if (sqlconf_conf == NULL &&
-        sqlconf_read_db(p, driver) < 0) {
-      return -1;
+    /* With a snapshot to serve, do not wait on the database at all. */
+    if (h->revalidate == TRUE &&
+        sqlconf_read_cache(h, p) == 0) {
+      pr_log_debug(DEBUG2, MOD_CONF_SQL_VERSION
+        ": using snapshot '%s', revalidating in the background",
+        h->cache_path);
+      sqlconf_revalidate(h, p, driver);
+
+      fh->fh_data = h;
+      return CONF_SQL_FILENO;
     }
 
+    sqlconf_start_deadline(h, driver);
+
+    if (sqlconf_deadline.active == TRUE) {
+      res = sqlconf_read_db_deadline(h, p, driver);
+
+    } else {
+      res = sqlconf_read_db(h, p, driver);
+    }
+    xerrno = errno;
+
+    if (sqlconf_end_deadline(p) < 0) {
+      res = -1;
+      xerrno = ETIMEDOUT;
+    }
+
+    if (res < 0) {
+      /* If the database cannot be read, fall back to the last snapshot of
+       * the configuration, if any.
+       */
+      h->frames = NULL;
+      if (sqlconf_read_cache(h, p) < 0) {
+        if (xerrno == ETIMEDOUT) {
+          pr_log_pri(PR_LOG_NOTICE, MOD_CONF_SQL_VERSION
+            ": unable to read configuration from database within %u ms, "
+            "and no snapshot available", h->deadline_ms);
+        }
+
+        destroy_pool(p);
+        errno = xerrno;
+        return -1;
+      }
+
+      if (xerrno == ETIMEDOUT) {
+        pr_log_pri(PR_LOG_NOTICE, MOD_CONF_SQL_VERSION
+          ": unable to read configuration from database within %u ms, using "
+          "STALE snapshot '%s'", h->deadline_ms, h->cache_path);
+
+      } else {
+        pr_log_pri(PR_LOG_NOTICE, MOD_CONF_SQL_VERSION
+          ": unable to read configuration from database (%s), using snapshot "
+          "'%s'", strerror(xerrno), h->cache_path);
+      }
+
+    } else if (h->unchanged == FALSE) {
+      sqlconf_write_cache(h, p);
+      sqlconf_remember_generation(h);
+    }
+
+    fh->fh_data = h;
+
     /* Return a fake file descriptor. */
     return CONF_SQL_FILENO;
   }
@@ -910,7 +4639,19 @@ static int sqlconf_fsio_open(pr_fh_t *fh, const char *path, int flags) {
 }
 
 static int sqlconf_fsio_close(pr_fh_t *fh, int fd) {
-  if (fd == CONF_SQL_FILENO) {
+  if (fd == CONF_SQL_FILENO &&
+      fh->fh_data != NULL) {
+    sqlconf_handle_t *h;
+
+    h = fh->fh_data;
+
+    /* The file may be closed before all of it was read, e.g. on a parse
+     * error.
+     */
+    sqlconf_end_frames(h);
+
+    destroy_pool(h->pool);
+    fh->fh_data = NULL;
     return 0;
   }
 
@@ -918,34 +4659,49 @@ static int sqlconf_fsio_close(pr_fh_t *fh, int fd) {
 }
 
 static int sqlconf_fsio_read(pr_fh_t *fh, int fd, char *buf, size_t buflen) {
+  int res;
 
   /* Make sure this filehandle is for this module before trying to use it. */
   if (fd == CONF_SQL_FILENO &&
       fh->fh_path != NULL &&
       strncmp(CONF_SQL_URI_PREFIX, fh->fh_path, CONF_SQL_URI_PREFIX_LEN) == 0) {
+    sqlconf_handle_t *h;
 
-    if (sqlconf_conf == NULL) {
+    h = fh->fh_data;
+    if (h == NULL ||
+        h->conf == NULL) {
       errno = ENOENT;
       return -1;
     }
 
-    if (sqlconf_confi < sqlconf_conf->nelts) {
-      char *line, **lines;
-      size_t line_len;
+    /* Read from our built-up buffer, as much as fits, until there is no more
+     * text to be read.
+     */
+    res = sqlconf_buf_read(h->conf, buf, buflen);
+
+    /* When generating lazily, all of the text generated so far has been
+     * read; discard it, and generate more.
+     */
+    while (res == 0 &&
+           h->frames != NULL) {
+      int step;
+
+      sqlconf_buf_clear(h->conf);
 
-      /* Read from our built-up buffer, until there are no more lines to be
-       * read.
-       */
-      lines = sqlconf_conf->elts;
-      line = lines[sqlconf_confi++];
-      line_len = strlen(line);
+      step = sqlconf_step_frames(h);
+      if (step == 0) {
+        sqlconf_end_frames(h);
+        break;
+      }
 
-      pr_trace_msg(trace_channel, 12, "%.*s", (int) line_len-1, line);
-      memcpy(buf, line, buflen);
-      return strlen(buf);
+      res = sqlconf_buf_read(h->conf, buf, buflen);
     }
 
-    return 0;
+    if (res > 0) {
+      pr_trace_msg(trace_channel, 12, "%.*s", res, buf);
+    }
+
+    return res;
   }
 
   /* Default normal read. */
@@ -957,6 +4713,13 @@ static int sqlconf_fsio_read(pr_fh_t *fh, int fd, char *buf, size_t buflen) {
 
 static void sqlconf_postparse_ev(const void *event_data, void *user_data) {
 
+  /* Stop the deadline helper, close the connections, and drop the tables
+   * read, kept for the parse.
+   */
+  sqlconf_stop_deadline_helper();
+  sqlconf_close_conns();
+  sqlconf_clear_memos();
+
   /* Unregister the registered FS. */
   if (pr_unregister_fs("sql://") < 0) {
     pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION ": error unregistering fs: %s",
@@ -971,13 +4734,6 @@ static void sqlconf_postparse_ev(const void *event_data, void *user_data) {
     pr_trace_use_stderr(FALSE);
     use_tracing = FALSE;
   }
-
-  if (sqlconf_conf_pool) {
-    destroy_pool(sqlconf_conf_pool);
-    sqlconf_conf_pool = NULL;
-    sqlconf_conf = NULL;
-    sqlconf_confi = 0;
-  }
 }
 
 static void sqlconf_restart_ev(const void *event_data, void *user_data) {
@@ -6,7 +6,8 @@ CREATE TABLE IF NOT EXISTS ftpctx (
   parent_id INTEGER UNSIGNED,
   name VARCHAR(255),
   type VARCHAR(255),
-  value VARCHAR(255)
+  value VARCHAR(255),
+  INDEX (name)
 );
 
 CREATE TABLE IF NOT EXISTS ftpconf (
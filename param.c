@@ -413,3 +413,281 @@ int sqlconf_param_parse_map(pool *p, pr_table_t *params, char **table,
 
   return 0;
 }
+
+/* Expected format of the generation parameter:
+ *
+ *   generation=table:<table>[:<column>]
+ *   generation=max:<column>
+ */
+int sqlconf_param_parse_generation(pool *p, pr_table_t *params, char **type,
+    char **table, char **col) {
+  const void *v;
+  size_t vsz;
+  char *val, *ptr;
+
+  if (p == NULL ||
+      params == NULL ||
+      type == NULL ||
+      table == NULL ||
+      col == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *type = *table = *col = NULL;
+
+  v = pr_table_get(params, "generation", &vsz);
+  if (v == NULL) {
+    return 0;
+  }
+
+  /* Ignore empty values.  Remember that table value lengths include the NUL. */
+  if (vsz < 2) {
+    return 0;
+  }
+
+  val = pstrndup(p, v, vsz);
+
+  ptr = strchr(val, ':');
+  if (ptr == NULL ||
+      *(ptr + 1) == '\0' ||
+      *(ptr + 1) == ':') {
+    pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+      ": badly formatted 'generation' parameter '%s': missing name", val);
+    errno = EINVAL;
+    return -1;
+  }
+
+  *ptr = '\0';
+
+  if (strcmp(val, "table") == 0) {
+    char *table_name;
+
+    table_name = ptr + 1;
+    ptr = strchr(table_name, ':');
+    if (ptr != NULL) {
+      *ptr = '\0';
+
+      if (*(ptr + 1) == '\0' ||
+          strchr(ptr + 1, ':') != NULL) {
+        pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+          ": badly formatted 'generation' parameter: bad column name");
+        errno = EINVAL;
+        return -1;
+      }
+
+      *col = pstrdup(p, ptr + 1);
+
+    } else {
+      *col = pstrdup(p, CONF_SQL_GENERATION_DEFAULT_COL_NAME);
+    }
+
+    *type = pstrdup(p, "table");
+    *table = pstrdup(p, table_name);
+    return 0;
+  }
+
+  if (strcmp(val, "max") == 0) {
+    if (strchr(ptr + 1, ':') != NULL) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": badly formatted 'generation' parameter: bad column name");
+      errno = EINVAL;
+      return -1;
+    }
+
+    *type = pstrdup(p, "max");
+    *col = pstrdup(p, ptr + 1);
+    return 0;
+  }
+
+  pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+    ": badly formatted 'generation' parameter: unknown type '%s'", val);
+  errno = EINVAL;
+  return -1;
+}
+
+static int param_parse_id(const char *text, unsigned long *id) {
+  char *ptr = NULL;
+
+  if (*text == '\0' ||
+      !PR_ISDIGIT((int) *text)) {
+    return -1;
+  }
+
+  errno = 0;
+  *id = strtoul(text, &ptr, 10);
+  if (errno != 0 ||
+      ptr == NULL ||
+      *ptr != '\0') {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Expected format of the base_id parameter:
+ *
+ *   base_id=<id>[,<id>|<first>-<last>...]
+ */
+int sqlconf_param_parse_base_ids(pool *p, pr_table_t *params,
+    array_header **ids) {
+  const void *v;
+  size_t vsz;
+  char *val, *item;
+
+  if (p == NULL ||
+      params == NULL ||
+      ids == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *ids = NULL;
+
+  v = pr_table_get(params, "base_id", &vsz);
+  if (v == NULL) {
+    return 0;
+  }
+
+  /* Ignore empty values.  Note that the value length need not include the
+   * NUL, so a single-character value may have a length of 1.
+   */
+  val = pstrndup(p, v, vsz);
+  if (*val == '\0') {
+    return 0;
+  }
+  *ids = make_array(p, 1, sizeof(char *));
+
+  item = val;
+  while (item != NULL) {
+    unsigned long first, last, id;
+    char *ptr, *next;
+
+    next = strchr(item, ',');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+
+    ptr = strchr(item, '-');
+    if (ptr != NULL) {
+      *ptr = '\0';
+
+      if (param_parse_id(item, &first) < 0 ||
+          param_parse_id(ptr + 1, &last) < 0 ||
+          first > last) {
+        pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+          ": badly formatted 'base_id' parameter: bad range '%s-%s'", item,
+          ptr + 1);
+        *ids = NULL;
+        errno = EINVAL;
+        return -1;
+      }
+
+    } else {
+      if (param_parse_id(item, &first) < 0) {
+        pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+          ": badly formatted 'base_id' parameter: bad ID '%s'", item);
+        *ids = NULL;
+        errno = EINVAL;
+        return -1;
+      }
+
+      last = first;
+    }
+
+    if (last - first >= CONF_SQL_BASE_IDS_MAX_COUNT ||
+        (*ids)->nelts + (last - first) >= CONF_SQL_BASE_IDS_MAX_COUNT) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": badly formatted 'base_id' parameter: more than %u IDs",
+        (unsigned int) CONF_SQL_BASE_IDS_MAX_COUNT);
+      *ids = NULL;
+      errno = EINVAL;
+      return -1;
+    }
+
+    /* Careful not to wrap around, for a range ending at ULONG_MAX. */
+    id = first;
+    while (TRUE) {
+      char idstr[32];
+
+      memset(idstr, '\0', sizeof(idstr));
+      snprintf(idstr, sizeof(idstr)-1, "%lu", id);
+      *((char **) push_array(*ids)) = pstrdup(p, idstr);
+
+      if (id == last) {
+        break;
+      }
+
+      id++;
+    }
+
+    item = next;
+  }
+
+  return 0;
+}
+
+/* Expected format of the base_name parameter:
+ *
+ *   base_name=<name>[,<name>...]
+ *
+ * where a name may end in '*', to match every name with that prefix.
+ */
+int sqlconf_param_parse_base_names(pool *p, pr_table_t *params,
+    array_header **names) {
+  const void *v;
+  size_t vsz;
+  char *val, *item;
+
+  if (p == NULL ||
+      params == NULL ||
+      names == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *names = NULL;
+
+  v = pr_table_get(params, "base_name", &vsz);
+  if (v == NULL) {
+    return 0;
+  }
+
+  /* Ignore empty values.  Note that the value length need not include the
+   * NUL, so a single-character value may have a length of 1.
+   */
+  val = pstrndup(p, v, vsz);
+  if (*val == '\0') {
+    return 0;
+  }
+  *names = make_array(p, 1, sizeof(char *));
+
+  item = val;
+  while (item != NULL) {
+    char *next, *ptr;
+
+    next = strchr(item, ',');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+
+    /* Only a trailing '*' is supported, so that every name can be matched
+     * using an equality or prefix comparison.
+     */
+    ptr = strpbrk(item, "*?[");
+    if (*item == '\0' ||
+        (ptr != NULL &&
+         (*ptr != '*' || *(ptr + 1) != '\0'))) {
+      pr_log_debug(DEBUG0, MOD_CONF_SQL_VERSION
+        ": badly formatted 'base_name' parameter: bad name '%s'", item);
+      *names = NULL;
+      errno = EINVAL;
+      return -1;
+    }
+
+    *((char **) push_array(*names)) = item;
+    item = next;
+  }
+
+  return 0;
+}
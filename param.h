@@ -50,6 +50,7 @@ int sqlconf_param_parse_ctx(pool *p, pr_table_t *params, char **table,
 #define CONF_SQL_CTX_DEFAULT_PARENT_ID_COL_NAME		"parent_id"
 #define CONF_SQL_CTX_DEFAULT_TYPE_COL_NAME		"type"
 #define CONF_SQL_CTX_DEFAULT_VALUE_COL_NAME		"value"
+#define CONF_SQL_CTX_DEFAULT_NAME_COL_NAME		"name"
 
 /* Expected format of the map parameter:
  *
@@ -61,4 +62,39 @@ int sqlconf_param_parse_map(pool *p, pr_table_t *params, char **table,
 #define CONF_SQL_MAP_DEFAULT_CONF_ID_COL_NAME		"conf_id"
 #define CONF_SQL_MAP_DEFAULT_CTX_ID_COL_NAME		"ctx_id"
 
+/* Expected format of the generation parameter:
+ *
+ *   generation=table:<table>[:<column>]
+ *   generation=max:<column>
+ *
+ * The type returned is either "table" (a single-row table holding the
+ * generation) or "max" (the latest value of the given column, across the
+ * ctx, conf, and map tables).
+ */
+int sqlconf_param_parse_generation(pool *p, pr_table_t *params, char **type,
+  char **table, char **col);
+#define CONF_SQL_GENERATION_DEFAULT_COL_NAME		"generation"
+
+/* Expected format of the base_id parameter:
+ *
+ *   base_id=<id>[,<id>|<first>-<last>...]
+ *
+ * The IDs (as text) are returned in the order listed, with ranges expanded.
+ * If there is no base_id parameter, the returned list is NULL.
+ */
+int sqlconf_param_parse_base_ids(pool *p, pr_table_t *params,
+  array_header **ids);
+#define CONF_SQL_BASE_IDS_MAX_COUNT		65536
+
+/* Expected format of the base_name parameter:
+ *
+ *   base_name=<name>[,<name>...]
+ *
+ * A name ending in '*' matches every name with that prefix; no other glob
+ * characters are supported.  The names are returned in the order listed.
+ * If there is no base_name parameter, the returned list is NULL.
+ */
+int sqlconf_param_parse_base_names(pool *p, pr_table_t *params,
+  array_header **names);
+
 #endif /* MOD_CONF_SQL_PARAM_H */
@@ -7,6 +7,8 @@ CREATE TABLE IF NOT EXISTS ftpctx (
   PRIMARY KEY (id)
 );
 
+CREATE INDEX IF NOT EXISTS ftpctx_name_idx ON ftpctx (name text_pattern_ops);
+
 CREATE TABLE IF NOT EXISTS ftpconf (
   id SERIAL,
   name TEXT NOT NULL,
@@ -6,6 +6,8 @@ CREATE TABLE IF NOT EXISTS ftpctx (
   value TEXT
 );
 
+CREATE INDEX IF NOT EXISTS ftpctx_name_idx ON ftpctx (name);
+
 CREATE TABLE IF NOT EXISTS ftpconf (
   id INTEGER PRIMARY KEY AUTOINCREMENT,
   name TEXT NOT NULL,
@@ -0,0 +1,248 @@
+/*
+ * ProFTPD - mod_conf_sql testsuite
+ * Copyright (c) 2016-2022 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Buffer API tests. */
+
+#include "tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (buf_create_test) {
+  sqlconf_buf_t *buf;
+  const char *text;
+  size_t textlen;
+
+  mark_point();
+  buf = sqlconf_buf_create(NULL, 0);
+  ck_assert_msg(buf == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  buf = sqlconf_buf_create(p, 0);
+  ck_assert_msg(buf != NULL, "Failed to create buffer: %s", strerror(errno));
+
+  text = sqlconf_buf_get_text(buf, &textlen);
+  ck_assert_msg(text != NULL, "Failed to get text: %s", strerror(errno));
+  ck_assert_msg(textlen == 0, "Expected length 0, got %lu",
+    (unsigned long) textlen);
+  ck_assert_msg(strcmp(text, "") == 0, "Expected '', got '%s'", text);
+}
+END_TEST
+
+START_TEST (buf_add_test) {
+  register unsigned int i;
+  int res;
+  sqlconf_buf_t *buf;
+  const char *text;
+  size_t textlen;
+
+  mark_point();
+  res = sqlconf_buf_add(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null buffer");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Start small, so that the buffer has to grow. */
+  buf = sqlconf_buf_create(p, 4);
+
+  mark_point();
+  res = sqlconf_buf_add(buf, "ServerName", " ", "\"foo\"", "\n", NULL);
+  ck_assert_msg(res == 0, "Failed to add text: %s", strerror(errno));
+
+  text = sqlconf_buf_get_text(buf, &textlen);
+  ck_assert_msg(strcmp(text, "ServerName \"foo\"\n") == 0,
+    "Expected 'ServerName \"foo\"\n', got '%s'", text);
+  ck_assert_msg(textlen == 17, "Expected length 17, got %lu",
+    (unsigned long) textlen);
+
+  for (i = 0; i < 1000; i++) {
+    res = sqlconf_buf_add(buf, "Umask 022\n", NULL);
+    ck_assert_msg(res == 0, "Failed to add text: %s", strerror(errno));
+  }
+
+  text = sqlconf_buf_get_text(buf, &textlen);
+  ck_assert_msg(textlen == 17 + (1000 * 10), "Expected length %lu, got %lu",
+    (unsigned long) 17 + (1000 * 10), (unsigned long) textlen);
+  ck_assert_msg(strlen(text) == textlen, "Expected length %lu, got %lu",
+    (unsigned long) textlen, (unsigned long) strlen(text));
+}
+END_TEST
+
+START_TEST (buf_read_test) {
+  int res;
+  sqlconf_buf_t *buf;
+  char data[8];
+
+  mark_point();
+  res = sqlconf_buf_read(NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null buffer");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  buf = sqlconf_buf_create(p, 0);
+
+  mark_point();
+  res = sqlconf_buf_read(buf, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null destination");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  sqlconf_buf_add(buf, "DenyAll \n", "Umask 022\n", NULL);
+
+  /* Reads span lines, and fill as much of the destination as fits. */
+  mark_point();
+  memset(data, '\0', sizeof(data));
+  res = sqlconf_buf_read(buf, data, sizeof(data));
+  ck_assert_msg(res == 8, "Expected 8, got %d", res);
+  ck_assert_msg(strncmp(data, "DenyAll ", 8) == 0,
+    "Expected 'DenyAll ', got '%.8s'", data);
+
+  mark_point();
+  memset(data, '\0', sizeof(data));
+  res = sqlconf_buf_read(buf, data, sizeof(data));
+  ck_assert_msg(res == 8, "Expected 8, got %d", res);
+  ck_assert_msg(strncmp(data, "\nUmask 0", 8) == 0,
+    "Expected '\nUmask 0', got '%.8s'", data);
+
+  mark_point();
+  memset(data, '\0', sizeof(data));
+  res = sqlconf_buf_read(buf, data, sizeof(data));
+  ck_assert_msg(res == 3, "Expected 3, got %d", res);
+  ck_assert_msg(strncmp(data, "22\n", 3) == 0, "Expected '22\n', got '%.3s'",
+    data);
+
+  mark_point();
+  res = sqlconf_buf_read(buf, data, sizeof(data));
+  ck_assert_msg(res == 0, "Expected 0, got %d", res);
+}
+END_TEST
+
+START_TEST (buf_clear_test) {
+  int res;
+  sqlconf_buf_t *buf;
+  const char *text;
+  size_t textlen;
+  char data[32];
+
+  mark_point();
+  res = sqlconf_buf_clear(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null buffer");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  buf = sqlconf_buf_create(p, 0);
+  sqlconf_buf_add(buf, "DenyAll \n", NULL);
+  sqlconf_buf_read(buf, data, sizeof(data));
+
+  mark_point();
+  res = sqlconf_buf_clear(buf);
+  ck_assert_msg(res == 0, "Failed to clear buffer: %s", strerror(errno));
+
+  text = sqlconf_buf_get_text(buf, &textlen);
+  ck_assert_msg(textlen == 0, "Expected length 0, got %lu",
+    (unsigned long) textlen);
+  ck_assert_msg(strcmp(text, "") == 0, "Expected '', got '%s'", text);
+
+  /* New text is read from the start again. */
+  sqlconf_buf_add(buf, "Umask 022\n", NULL);
+
+  memset(data, '\0', sizeof(data));
+  res = sqlconf_buf_read(buf, data, sizeof(data));
+  ck_assert_msg(res == 10, "Expected 10, got %d", res);
+  ck_assert_msg(strcmp(data, "Umask 022\n") == 0,
+    "Expected 'Umask 022\n', got '%s'", data);
+}
+END_TEST
+
+START_TEST (buf_get_size_test) {
+  register unsigned int i;
+  size_t sz, textlen;
+  sqlconf_buf_t *buf;
+
+  mark_point();
+  sz = sqlconf_buf_get_size(NULL);
+  ck_assert_msg(sz == 0, "Expected 0, got %lu", (unsigned long) sz);
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  buf = sqlconf_buf_create(p, 16);
+  sz = sqlconf_buf_get_size(buf);
+  ck_assert_msg(sz == 16, "Expected 16, got %lu", (unsigned long) sz);
+
+  /* Render many rows, each from its own short-lived pool, as the loader
+   * does for each query; however many times the buffer grows, it holds no
+   * more than twice the size of the text.
+   */
+  for (i = 0; i < 10000; i++) {
+    pool *tmp_pool;
+    char *row;
+
+    tmp_pool = make_sub_pool(p);
+    row = pcalloc(tmp_pool, 64);
+    snprintf(row, 63, "AllowOverwrite %u\n", i);
+    sqlconf_buf_add(buf, row, NULL);
+    destroy_pool(tmp_pool);
+  }
+
+  (void) sqlconf_buf_get_text(buf, &textlen);
+  sz = sqlconf_buf_get_size(buf);
+  ck_assert_msg(sz > textlen, "Expected more than %lu, got %lu",
+    (unsigned long) textlen, (unsigned long) sz);
+  ck_assert_msg(sz <= textlen * 2, "Expected at most %lu, got %lu",
+    (unsigned long) (textlen * 2), (unsigned long) sz);
+}
+END_TEST
+
+Suite *tests_get_buf_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("buf");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, buf_create_test);
+  tcase_add_test(testcase, buf_add_test);
+  tcase_add_test(testcase, buf_read_test);
+  tcase_add_test(testcase, buf_clear_test);
+  tcase_add_test(testcase, buf_get_size_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -0,0 +1,209 @@
+/*
+ * ProFTPD - mod_conf_sql testsuite
+ * Copyright (c) 2016-2022 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Snapshot cache API tests. */
+
+#include "tests.h"
+
+static pool *p = NULL;
+
+static const char *cache_path = "/tmp/conf-sql-test-cache.conf";
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+
+  (void) unlink(cache_path);
+}
+
+static void tear_down(void) {
+  (void) unlink(cache_path);
+
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (cache_hash_test) {
+  const char *hash, *hash2;
+
+  mark_point();
+  hash = sqlconf_cache_hash(p, "", 0);
+  ck_assert_msg(strcmp(hash, "cbf29ce484222325") == 0,
+    "Expected 'cbf29ce484222325', got '%s'", hash);
+
+  hash = sqlconf_cache_hash(p, "DenyAll \n", 9);
+  hash2 = sqlconf_cache_hash(p, "DenyAll\n", 8);
+  ck_assert_msg(strcmp(hash, hash2) != 0, "Expected different hashes");
+}
+END_TEST
+
+START_TEST (cache_write_test) {
+  int fd, res;
+  char *tmp_path, numbuf[64];
+  const char *target_path = "/tmp/conf-sql-test-cache.target";
+  struct stat st;
+
+  mark_point();
+  res = sqlconf_cache_write(NULL, NULL, NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_cache_write(p, NULL, NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null path");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_cache_write(p, cache_path, NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null text");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_cache_write(p, cache_path, "foo\nbar", "", 0);
+  ck_assert_msg(res < 0, "Failed to handle multi-line generation");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_cache_write(p, "/no/such/dir/cache.conf", NULL, "", 0);
+  ck_assert_msg(res < 0, "Failed to handle bad path");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_cache_write(p, cache_path, NULL, "DenyAll \n", 9);
+  ck_assert_msg(res == 0, "Failed to write snapshot: %s", strerror(errno));
+
+  /* A link planted at the old, predictable, temporary name is not
+   * followed.
+   */
+  memset(numbuf, '\0', sizeof(numbuf));
+  snprintf(numbuf, sizeof(numbuf)-1, "%lu", (unsigned long) getpid());
+  tmp_path = pstrcat(p, cache_path, ".", numbuf, ".tmp", NULL);
+
+  (void) unlink(target_path);
+  (void) unlink(tmp_path);
+  fd = open(target_path, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+  ck_assert_msg(fd >= 0, "Failed to open '%s': %s", target_path,
+    strerror(errno));
+  (void) write(fd, "target", 6);
+  (void) close(fd);
+  ck_assert_msg(symlink(target_path, tmp_path) == 0,
+    "Failed to symlink '%s': %s", tmp_path, strerror(errno));
+
+  mark_point();
+  res = sqlconf_cache_write(p, cache_path, NULL, "DenyAll \n", 9);
+  ck_assert_msg(res == 0, "Failed to write snapshot: %s", strerror(errno));
+
+  res = stat(target_path, &st);
+  ck_assert_msg(res == 0, "Failed to stat '%s': %s", target_path,
+    strerror(errno));
+  ck_assert_msg(st.st_size == 6, "Expected 6 bytes, got %lu",
+    (unsigned long) st.st_size);
+
+  (void) unlink(tmp_path);
+  (void) unlink(target_path);
+}
+END_TEST
+
+START_TEST (cache_read_test) {
+  int fd, res;
+  char *generation = NULL, *text = NULL;
+  const char *expected;
+  size_t textlen = 0;
+
+  mark_point();
+  res = sqlconf_cache_read(NULL, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_cache_read(p, cache_path, &generation, &text, &textlen);
+  ck_assert_msg(res < 0, "Failed to handle missing snapshot");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  expected = "ServerName \"foo\"\n<Global>\nUmask 022\n</Global>\n";
+  res = sqlconf_cache_write(p, cache_path, "42", expected, strlen(expected));
+  ck_assert_msg(res == 0, "Failed to write snapshot: %s", strerror(errno));
+
+  mark_point();
+  res = sqlconf_cache_read(p, cache_path, &generation, &text, &textlen);
+  ck_assert_msg(res == 0, "Failed to read snapshot: %s", strerror(errno));
+  ck_assert_msg(generation != NULL, "Expected generation, got null");
+  ck_assert_msg(strcmp(generation, "42") == 0, "Expected '42', got '%s'",
+    generation);
+  ck_assert_msg(textlen == strlen(expected), "Expected length %lu, got %lu",
+    (unsigned long) strlen(expected), (unsigned long) textlen);
+  ck_assert_msg(strncmp(text, expected, textlen) == 0,
+    "Expected '%s', got '%.*s'", expected, (int) textlen, text);
+
+  /* A truncated snapshot is rejected. */
+  res = truncate(cache_path, 90);
+  ck_assert_msg(res == 0, "Failed to truncate snapshot: %s", strerror(errno));
+
+  mark_point();
+  res = sqlconf_cache_read(p, cache_path, &generation, &text, &textlen);
+  ck_assert_msg(res < 0, "Failed to handle truncated snapshot");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* As is a file which is not a snapshot. */
+  fd = open(cache_path, O_WRONLY|O_TRUNC);
+  ck_assert_msg(fd >= 0, "Failed to open '%s': %s", cache_path,
+    strerror(errno));
+  res = write(fd, "ServerName \"foo\"\n", 17);
+  (void) close(fd);
+
+  mark_point();
+  res = sqlconf_cache_read(p, cache_path, &generation, &text, &textlen);
+  ck_assert_msg(res < 0, "Failed to handle non-snapshot file");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+}
+END_TEST
+
+Suite *tests_get_cache_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("cache");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, cache_hash_test);
+  tcase_add_test(testcase, cache_write_test);
+  tcase_add_test(testcase, cache_read_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
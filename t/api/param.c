@@ -844,6 +844,335 @@ START_TEST (param_parse_map_test) {
 }
 END_TEST
 
+/* Expected format of the generation parameter:
+ *
+ *   generation=table:<table>[:<column>]
+ *   generation=max:<column>
+ */
+START_TEST (param_parse_generation_test) {
+  register unsigned int i;
+  int res;
+  char *type, *table, *col, *param;
+  pr_table_t *params;
+  const char *bad_params[] = {
+    "foo",
+    "table",
+    "table:",
+    "table::version",
+    "table:ftpversion:",
+    "table:ftpversion:version:foo",
+    "max:",
+    "max:updated:foo",
+    "min:updated",
+    NULL
+  };
+
+  mark_point();
+  res = sqlconf_param_parse_generation(NULL, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_param_parse_generation(p, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null params");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  params = pr_table_alloc(p, 1);
+
+  mark_point();
+  res = sqlconf_param_parse_generation(p, params, &type, &table, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null col");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* No "generation" parameter. */
+  mark_point();
+  res = sqlconf_param_parse_generation(p, params, &type, &table, &col);
+  ck_assert_msg(res == 0, "Failed to parse generation param: %s",
+    strerror(errno));
+  ck_assert_msg(type == NULL, "Expected null, got type '%s'", type);
+
+  /* Table name, default column name. */
+  pr_table_empty(params);
+  param = "table:ftpversion";
+  pr_table_add(params, pstrdup(p, "generation"), pstrdup(p, param), 0);
+
+  mark_point();
+  res = sqlconf_param_parse_generation(p, params, &type, &table, &col);
+  ck_assert_msg(res == 0, "Failed to parse generation param: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(type, "table") == 0, "Expected 'table', got '%s'",
+    type);
+  ck_assert_msg(strcmp(table, "ftpversion") == 0,
+    "Expected 'ftpversion', got '%s'", table);
+  ck_assert_msg(strcmp(col, CONF_SQL_GENERATION_DEFAULT_COL_NAME) == 0,
+    "Expected '%s', got '%s'", CONF_SQL_GENERATION_DEFAULT_COL_NAME, col);
+
+  /* Table name and column name. */
+  pr_table_empty(params);
+  param = "table:ftpversion:version";
+  pr_table_add(params, pstrdup(p, "generation"), pstrdup(p, param), 0);
+
+  mark_point();
+  res = sqlconf_param_parse_generation(p, params, &type, &table, &col);
+  ck_assert_msg(res == 0, "Failed to parse generation param: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(table, "ftpversion") == 0,
+    "Expected 'ftpversion', got '%s'", table);
+  ck_assert_msg(strcmp(col, "version") == 0, "Expected 'version', got '%s'",
+    col);
+
+  /* Latest column value. */
+  pr_table_empty(params);
+  param = "max:updated_at";
+  pr_table_add(params, pstrdup(p, "generation"), pstrdup(p, param), 0);
+
+  mark_point();
+  res = sqlconf_param_parse_generation(p, params, &type, &table, &col);
+  ck_assert_msg(res == 0, "Failed to parse generation param: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(type, "max") == 0, "Expected 'max', got '%s'", type);
+  ck_assert_msg(table == NULL, "Expected null, got table '%s'", table);
+  ck_assert_msg(strcmp(col, "updated_at") == 0,
+    "Expected 'updated_at', got '%s'", col);
+
+  /* Malformed "generation" parameters. */
+  for (i = 0; bad_params[i] != NULL; i++) {
+    pr_table_empty(params);
+    pr_table_add(params, pstrdup(p, "generation"), pstrdup(p, bad_params[i]),
+      0);
+
+    mark_point();
+    res = sqlconf_param_parse_generation(p, params, &type, &table, &col);
+    ck_assert_msg(res < 0, "Failed to handle invalid generation param '%s'",
+      bad_params[i]);
+    ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+      strerror(errno), errno);
+  }
+
+  pr_table_empty(params);
+  pr_table_free(params);
+}
+END_TEST
+
+/* Expected format of the base_id parameter:
+ *
+ *   base_id=<id>[,<id>|<first>-<last>...]
+ */
+START_TEST (param_parse_base_ids_test) {
+  register unsigned int i;
+  int res;
+  char *param, **elts;
+  array_header *ids;
+  pr_table_t *params;
+  const char *bad_params[] = {
+    "foo",
+    "7,",
+    ",7",
+    "7,,9",
+    "-7",
+    "7-",
+    "9-7",
+    "7-9-11",
+    "0x10",
+    "7 ",
+    "1-100000",
+    NULL
+  };
+
+  mark_point();
+  res = sqlconf_param_parse_base_ids(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_param_parse_base_ids(p, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null params");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  params = pr_table_alloc(p, 1);
+
+  mark_point();
+  res = sqlconf_param_parse_base_ids(p, params, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null ids");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* No "base_id" parameter. */
+  mark_point();
+  res = sqlconf_param_parse_base_ids(p, params, &ids);
+  ck_assert_msg(res == 0, "Failed to parse base_id param: %s",
+    strerror(errno));
+  ck_assert_msg(ids == NULL, "Expected null ids");
+
+  /* A single ID. */
+  pr_table_empty(params);
+  param = "7";
+  pr_table_add(params, pstrdup(p, "base_id"), pstrdup(p, param), 0);
+
+  mark_point();
+  res = sqlconf_param_parse_base_ids(p, params, &ids);
+  ck_assert_msg(res == 0, "Failed to parse base_id param: %s",
+    strerror(errno));
+  ck_assert_msg(ids != NULL, "Expected ids");
+  ck_assert_msg(ids->nelts == 1, "Expected 1 ID, got %u", ids->nelts);
+
+  elts = ids->elts;
+  ck_assert_msg(strcmp(elts[0], "7") == 0, "Expected '7', got '%s'",
+    elts[0]);
+
+  /* A single ID, stored without its NUL, as when parsed from a URI. */
+  pr_table_empty(params);
+  pr_table_add(params, pstrdup(p, "base_id"), pstrdup(p, param), 1);
+
+  mark_point();
+  res = sqlconf_param_parse_base_ids(p, params, &ids);
+  ck_assert_msg(res == 0, "Failed to parse base_id param: %s",
+    strerror(errno));
+  ck_assert_msg(ids != NULL, "Expected ids");
+  ck_assert_msg(ids->nelts == 1, "Expected 1 ID, got %u", ids->nelts);
+
+  /* IDs and ranges, in the order listed. */
+  pr_table_empty(params);
+  param = "12,7,009,2-4,5-5";
+  pr_table_add(params, pstrdup(p, "base_id"), pstrdup(p, param), 0);
+
+  mark_point();
+  res = sqlconf_param_parse_base_ids(p, params, &ids);
+  ck_assert_msg(res == 0, "Failed to parse base_id param: %s",
+    strerror(errno));
+  ck_assert_msg(ids->nelts == 7, "Expected 7 IDs, got %u", ids->nelts);
+
+  elts = ids->elts;
+  ck_assert_msg(strcmp(elts[0], "12") == 0, "Expected '12', got '%s'",
+    elts[0]);
+  ck_assert_msg(strcmp(elts[2], "9") == 0, "Expected '9', got '%s'",
+    elts[2]);
+  ck_assert_msg(strcmp(elts[3], "2") == 0, "Expected '2', got '%s'",
+    elts[3]);
+  ck_assert_msg(strcmp(elts[5], "4") == 0, "Expected '4', got '%s'",
+    elts[5]);
+  ck_assert_msg(strcmp(elts[6], "5") == 0, "Expected '5', got '%s'",
+    elts[6]);
+
+  /* Malformed "base_id" parameters. */
+  for (i = 0; bad_params[i] != NULL; i++) {
+    pr_table_empty(params);
+    pr_table_add(params, pstrdup(p, "base_id"), pstrdup(p, bad_params[i]), 0);
+
+    mark_point();
+    res = sqlconf_param_parse_base_ids(p, params, &ids);
+    ck_assert_msg(res < 0, "Failed to handle invalid base_id param '%s'",
+      bad_params[i]);
+    ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+      strerror(errno), errno);
+  }
+
+  pr_table_empty(params);
+  pr_table_free(params);
+}
+END_TEST
+
+START_TEST (param_parse_base_names_test) {
+  register unsigned int i;
+  int res;
+  char *param, **elts;
+  array_header *names;
+  pr_table_t *params;
+  const char *bad_params[] = {
+    "foo,",
+    ",foo",
+    "foo,,bar",
+    "tenant-*-a",
+    "*foo",
+    "tenant-?",
+    "tenant-[0-9]",
+    "foo**",
+    NULL
+  };
+
+  mark_point();
+  res = sqlconf_param_parse_base_names(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_param_parse_base_names(p, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null params");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  params = pr_table_alloc(p, 1);
+
+  mark_point();
+  res = sqlconf_param_parse_base_names(p, params, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null names");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* No "base_name" parameter. */
+  mark_point();
+  res = sqlconf_param_parse_base_names(p, params, &names);
+  ck_assert_msg(res == 0, "Failed to parse base_name param: %s",
+    strerror(errno));
+  ck_assert_msg(names == NULL, "Expected null names");
+
+  /* A single-character name, stored without its NUL. */
+  pr_table_empty(params);
+  param = "x";
+  pr_table_add(params, pstrdup(p, "base_name"), pstrdup(p, param), 1);
+
+  mark_point();
+  res = sqlconf_param_parse_base_names(p, params, &names);
+  ck_assert_msg(res == 0, "Failed to parse base_name param: %s",
+    strerror(errno));
+  ck_assert_msg(names != NULL, "Expected names");
+  ck_assert_msg(names->nelts == 1, "Expected 1 name, got %u", names->nelts);
+
+  /* Names and prefixes, in the order listed. */
+  pr_table_empty(params);
+  param = "www,tenant-*,*";
+  pr_table_add(params, pstrdup(p, "base_name"), pstrdup(p, param), 0);
+
+  mark_point();
+  res = sqlconf_param_parse_base_names(p, params, &names);
+  ck_assert_msg(res == 0, "Failed to parse base_name param: %s",
+    strerror(errno));
+  ck_assert_msg(names != NULL, "Expected names");
+  ck_assert_msg(names->nelts == 3, "Expected 3 names, got %u", names->nelts);
+
+  elts = names->elts;
+  ck_assert_msg(strcmp(elts[0], "www") == 0, "Expected 'www', got '%s'",
+    elts[0]);
+  ck_assert_msg(strcmp(elts[1], "tenant-*") == 0,
+    "Expected 'tenant-*', got '%s'", elts[1]);
+  ck_assert_msg(strcmp(elts[2], "*") == 0, "Expected '*', got '%s'",
+    elts[2]);
+
+  /* Malformed "base_name" parameters. */
+  for (i = 0; bad_params[i] != NULL; i++) {
+    pr_table_empty(params);
+    pr_table_add(params, pstrdup(p, "base_name"), pstrdup(p, bad_params[i]),
+      0);
+
+    mark_point();
+    res = sqlconf_param_parse_base_names(p, params, &names);
+    ck_assert_msg(res < 0, "Failed to handle invalid base_name param '%s'",
+      bad_params[i]);
+    ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+      strerror(errno), errno);
+  }
+
+  pr_table_empty(params);
+  pr_table_free(params);
+}
+END_TEST
+
 Suite *tests_get_param_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -856,6 +1185,9 @@ Suite *tests_get_param_suite(void) {
   tcase_add_test(testcase, param_parse_conf_test);
   tcase_add_test(testcase, param_parse_ctx_test);
   tcase_add_test(testcase, param_parse_map_test);
+  tcase_add_test(testcase, param_parse_generation_test);
+  tcase_add_test(testcase, param_parse_base_ids_test);
+  tcase_add_test(testcase, param_parse_base_names_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
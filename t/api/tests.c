@@ -32,6 +32,10 @@ struct testsuite_info {
 static struct testsuite_info suites[] = {
   { "uri",		tests_get_uri_suite },
   { "param",		tests_get_param_suite },
+  { "tree",		tests_get_tree_suite },
+  { "buf",		tests_get_buf_suite },
+  { "cache",		tests_get_cache_suite },
+  { "workers",		tests_get_workers_suite },
 
   { NULL, NULL }
 };
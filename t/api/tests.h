@@ -31,6 +31,10 @@
 
 #include "uri.h"
 #include "param.h"
+#include "tree.h"
+#include "buf.h"
+#include "cache.h"
+#include "workers.h"
 
 #ifdef HAVE_CHECK_H
 # include <check.h>
@@ -40,6 +44,10 @@
 
 Suite *tests_get_uri_suite(void);
 Suite *tests_get_param_suite(void);
+Suite *tests_get_tree_suite(void);
+Suite *tests_get_buf_suite(void);
+Suite *tests_get_cache_suite(void);
+Suite *tests_get_workers_suite(void);
 
 extern volatile unsigned int recvd_signal_flags;
 extern pid_t mpid;
@@ -0,0 +1,709 @@
+/*
+ * ProFTPD - mod_conf_sql testsuite
+ * Copyright (c) 2016-2022 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Tree API tests. */
+
+#include "tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (tree_create_test) {
+  sqlconf_tree_t *tree;
+
+  mark_point();
+  tree = sqlconf_tree_create(NULL);
+  ck_assert_msg(tree == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  tree = sqlconf_tree_create(p);
+  ck_assert_msg(tree != NULL, "Failed to create tree: %s", strerror(errno));
+}
+END_TEST
+
+START_TEST (tree_add_ctx_test) {
+  int res;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node;
+  const char *text;
+
+  mark_point();
+  res = sqlconf_tree_add_ctx(NULL, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+
+  mark_point();
+  res = sqlconf_tree_add_ctx(tree, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null id");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_tree_add_ctx(tree, "1", NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null type");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_tree_add_ctx(tree, "foo", NULL, "default", NULL);
+  ck_assert_msg(res < 0, "Failed to handle non-numeric id");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_tree_add_ctx(tree, "1", "1x", "default", NULL);
+  ck_assert_msg(res < 0, "Failed to handle non-numeric parent id");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_tree_add_ctx(tree, "1", "", "default", "");
+  ck_assert_msg(res == 0, "Failed to add context: %s", strerror(errno));
+
+  mark_point();
+  res = sqlconf_tree_add_ctx(tree, "1", "", "default", "");
+  ck_assert_msg(res < 0, "Failed to handle duplicate context");
+  ck_assert_msg(errno == EEXIST, "Expected EEXIST (%d), got %s (%d)", EEXIST,
+    strerror(errno), errno);
+
+  mark_point();
+  node = sqlconf_tree_get_ctx(tree, "1");
+  ck_assert_msg(node != NULL, "Failed to get context: %s", strerror(errno));
+  ck_assert_msg(node->id == 1, "Expected ID 1, got %lld",
+    (long long) node->id);
+  ck_assert_msg(node->have_parent == FALSE, "Expected no parent ID");
+  ck_assert_msg(node->value == 0, "Expected no value");
+
+  text = sqlconf_tree_get_str(tree, node->type);
+  ck_assert_msg(text != NULL, "Failed to get type: %s", strerror(errno));
+  ck_assert_msg(strcmp(text, "default") == 0, "Expected 'default', got '%s'",
+    text);
+
+  text = sqlconf_tree_get_str(tree, node->value);
+  ck_assert_msg(text == NULL, "Expected null value, got '%s'", text);
+
+  mark_point();
+  node = sqlconf_tree_get_ctx(tree, "2");
+  ck_assert_msg(node == NULL, "Failed to handle unknown context");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (tree_add_conf_test) {
+  int res;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node;
+  sqlconf_buf_t *buf;
+  const char *text, *expected;
+
+  mark_point();
+  res = sqlconf_tree_add_conf(NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+
+  mark_point();
+  res = sqlconf_tree_add_conf(tree, "1", NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null name");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Directives may arrive before their context row. */
+  mark_point();
+  res = sqlconf_tree_add_conf(tree, "1", "ServerName", "\"foo\"");
+  ck_assert_msg(res == 0, "Failed to add directive: %s", strerror(errno));
+
+  res = sqlconf_tree_add_conf(tree, "1", "DenyAll", NULL);
+  ck_assert_msg(res == 0, "Failed to add directive: %s", strerror(errno));
+
+  node = sqlconf_tree_get_ctx(tree, "1");
+  ck_assert_msg(node == NULL, "Expected no context row yet");
+
+  res = sqlconf_tree_add_ctx(tree, "1", NULL, "default", NULL);
+  ck_assert_msg(res == 0, "Failed to add context: %s", strerror(errno));
+
+  node = sqlconf_tree_get_ctx(tree, "1");
+  ck_assert_msg(node != NULL, "Failed to get context: %s", strerror(errno));
+  ck_assert_msg(node->nconfs == 2, "Expected 2 directives, got %u",
+    node->nconfs);
+
+  buf = sqlconf_buf_create(p, 0);
+  sqlconf_tree_render_confs(tree, "1", buf);
+
+  text = sqlconf_buf_get_text(buf, NULL);
+  expected = "ServerName \"foo\"\nDenyAll \n";
+  ck_assert_msg(strcmp(text, expected) == 0, "Expected '%s', got '%s'",
+    expected, text);
+}
+END_TEST
+
+START_TEST (tree_render_confs_test) {
+  int res;
+  sqlconf_tree_t *tree;
+  sqlconf_buf_t *buf;
+  const char *text, *expected;
+
+  mark_point();
+  res = sqlconf_tree_render_confs(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+  buf = sqlconf_buf_create(p, 0);
+
+  mark_point();
+  res = sqlconf_tree_render_confs(tree, NULL, buf);
+  ck_assert_msg(res < 0, "Failed to handle null ctx_id");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_tree_render_confs(tree, "1", buf);
+  ck_assert_msg(res < 0, "Failed to handle unknown ctx_id");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  sqlconf_tree_add_ctx(tree, "1", NULL, "default", NULL);
+
+  mark_point();
+  res = sqlconf_tree_render_confs(tree, "1", buf);
+  ck_assert_msg(res < 0, "Failed to handle context without directives");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  /* No context row is needed, only directives. */
+  sqlconf_tree_add_conf(tree, "2", "Umask", "022");
+  sqlconf_tree_add_conf(tree, "2", "DenyAll", "");
+
+  mark_point();
+  res = sqlconf_tree_render_confs(tree, "2", buf);
+  ck_assert_msg(res == 0, "Failed to render directives: %s",
+    strerror(errno));
+
+  text = sqlconf_buf_get_text(buf, NULL);
+  expected = "Umask 022\nDenyAll \n";
+  ck_assert_msg(strcmp(text, expected) == 0, "Expected '%s', got '%s'",
+    expected, text);
+}
+END_TEST
+
+START_TEST (tree_link_test) {
+  int res;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node, *child;
+
+  mark_point();
+  res = sqlconf_tree_link(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+
+  mark_point();
+  node = sqlconf_tree_get_root(tree);
+  ck_assert_msg(node == NULL, "Failed to handle empty tree");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  /* Children before parents, and an orphan. */
+  sqlconf_tree_add_ctx(tree, "3", "1", "VirtualHost", "1.2.3.4");
+  sqlconf_tree_add_ctx(tree, "2", "1", "Directory", "/");
+  sqlconf_tree_add_ctx(tree, "4", "99", "Anonymous", "~ftp");
+  sqlconf_tree_add_ctx(tree, "1", "", "default", NULL);
+
+  mark_point();
+  res = sqlconf_tree_link(tree);
+  ck_assert_msg(res == 0, "Failed to link tree: %s", strerror(errno));
+
+  /* Linking again should not duplicate anything. */
+  res = sqlconf_tree_link(tree);
+  ck_assert_msg(res == 0, "Failed to link tree: %s", strerror(errno));
+
+  node = sqlconf_tree_get_root(tree);
+  ck_assert_msg(node != NULL, "Failed to get root: %s", strerror(errno));
+  ck_assert_msg(node->id == 1, "Expected 1, got %lld", (long long) node->id);
+  ck_assert_msg(node->nchildren == 2, "Expected 2 children, got %u",
+    node->nchildren);
+
+  /* Children are kept in row order. */
+  child = sqlconf_tree_get_node(tree, node->first_child);
+  ck_assert_msg(child != NULL, "Failed to get child: %s", strerror(errno));
+  ck_assert_msg(child->id == 3, "Expected 3, got %lld", (long long) child->id);
+  ck_assert_msg(sqlconf_tree_get_node(tree, child->parent) == node,
+    "Expected parent link");
+
+  child = sqlconf_tree_get_node(tree, child->next_sibling);
+  ck_assert_msg(child != NULL, "Failed to get sibling: %s", strerror(errno));
+  ck_assert_msg(child->id == 2, "Expected 2, got %lld", (long long) child->id);
+  ck_assert_msg(child->next_sibling == -1, "Expected last sibling");
+
+  node = sqlconf_tree_get_ctx(tree, "4");
+  ck_assert_msg(node != NULL, "Failed to get context: %s", strerror(errno));
+  ck_assert_msg(node->parent == -1, "Expected orphan to be unlinked");
+
+  /* A loop of parent IDs, with a context hanging off of the loop. */
+  sqlconf_tree_add_ctx(tree, "6", "7", "Directory", "/a");
+  sqlconf_tree_add_ctx(tree, "7", "6", "Directory", "/b");
+  sqlconf_tree_add_ctx(tree, "8", "6", "Directory", "/c");
+
+  mark_point();
+  res = sqlconf_tree_link(tree);
+  ck_assert_msg(res == 0, "Failed to link tree: %s", strerror(errno));
+
+  node = sqlconf_tree_get_ctx(tree, "6");
+  ck_assert_msg(node != NULL, "Failed to get context: %s", strerror(errno));
+  ck_assert_msg(node->parent == -1, "Expected loop to be unlinked");
+  ck_assert_msg(node->nchildren == 1, "Expected 1 child, got %u",
+    node->nchildren);
+
+  node = sqlconf_tree_get_ctx(tree, "7");
+  ck_assert_msg(node != NULL, "Failed to get context: %s", strerror(errno));
+  ck_assert_msg(node->parent == -1, "Expected loop to be unlinked");
+  ck_assert_msg(node->nchildren == 0, "Expected 0 children, got %u",
+    node->nchildren);
+
+  sqlconf_tree_add_ctx(tree, "5", NULL, "default", NULL);
+  sqlconf_tree_link(tree);
+
+  mark_point();
+  node = sqlconf_tree_get_root(tree);
+  ck_assert_msg(node == NULL, "Failed to handle multiple roots");
+  ck_assert_msg(errno == EEXIST, "Expected EEXIST (%d), got %s (%d)", EEXIST,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (tree_set_version_test) {
+  int res;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node;
+  const char *text;
+
+  mark_point();
+  res = sqlconf_tree_set_version(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+
+  mark_point();
+  res = sqlconf_tree_set_version(tree, "1", NULL);
+  ck_assert_msg(res < 0, "Failed to handle null version");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Directives alone do not make a context. */
+  sqlconf_tree_add_conf(tree, "1", "ServerName", "\"foo\"");
+
+  mark_point();
+  res = sqlconf_tree_set_version(tree, "1", "7");
+  ck_assert_msg(res < 0, "Failed to handle missing context");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  sqlconf_tree_add_ctx(tree, "1", NULL, "default", NULL);
+
+  mark_point();
+  res = sqlconf_tree_set_version(tree, "1", "7");
+  ck_assert_msg(res == 0, "Failed to set version: %s", strerror(errno));
+
+  node = sqlconf_tree_get_ctx(tree, "1");
+  ck_assert_msg(node != NULL, "Failed to get context: %s", strerror(errno));
+
+  text = sqlconf_tree_get_str(tree, node->version);
+  ck_assert_msg(text != NULL, "Failed to get version: %s", strerror(errno));
+  ck_assert_msg(strcmp(text, "7") == 0, "Expected '7', got '%s'", text);
+}
+END_TEST
+
+START_TEST (tree_copy_ctx_test) {
+  int res;
+  sqlconf_tree_t *src, *dst;
+  sqlconf_node_t *node;
+  sqlconf_buf_t *buf;
+  const char *text, *expected;
+
+  mark_point();
+  res = sqlconf_tree_copy_ctx(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  src = sqlconf_tree_create(p);
+  dst = sqlconf_tree_create(p);
+
+  mark_point();
+  res = sqlconf_tree_copy_ctx(dst, src, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null node");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  sqlconf_tree_add_ctx(src, "1", NULL, "default", NULL);
+  sqlconf_tree_add_ctx(src, "2", "1", "Directory", "/");
+  sqlconf_tree_set_version(src, "2", "3");
+  sqlconf_tree_add_conf(src, "2", "Umask", "022");
+  sqlconf_tree_add_conf(src, "2", "AllowOverwrite", "on");
+
+  node = sqlconf_tree_get_ctx(src, "2");
+
+  mark_point();
+  res = sqlconf_tree_copy_ctx(dst, src, node);
+  ck_assert_msg(res == 0, "Failed to copy context: %s", strerror(errno));
+
+  node = sqlconf_tree_get_ctx(dst, "2");
+  ck_assert_msg(node != NULL, "Failed to get context: %s", strerror(errno));
+  ck_assert_msg(node->have_parent == TRUE && node->parent_id == 1,
+    "Expected parent ID 1, got %lld", (long long) node->parent_id);
+
+  text = sqlconf_tree_get_str(dst, node->value);
+  ck_assert_msg(strcmp(text, "/") == 0, "Expected '/', got '%s'", text);
+
+  text = sqlconf_tree_get_str(dst, node->version);
+  ck_assert_msg(strcmp(text, "3") == 0, "Expected '3', got '%s'", text);
+
+  ck_assert_msg(node->nconfs == 2, "Expected 2 directives, got %u",
+    node->nconfs);
+
+  buf = sqlconf_buf_create(p, 0);
+  sqlconf_tree_render_confs(dst, "2", buf);
+
+  text = sqlconf_buf_get_text(buf, NULL);
+  expected = "Umask 022\nAllowOverwrite on\n";
+  ck_assert_msg(strcmp(text, expected) == 0, "Expected '%s', got '%s'",
+    expected, text);
+
+  /* Children are not copied. */
+  node = sqlconf_tree_get_ctx(dst, "1");
+  ck_assert_msg(node == NULL, "Unexpectedly copied parent context");
+
+  mark_point();
+  res = sqlconf_tree_copy_ctx(dst, src, sqlconf_tree_get_ctx(src, "2"));
+  ck_assert_msg(res < 0, "Failed to handle duplicate context");
+  ck_assert_msg(errno == EEXIST, "Expected EEXIST (%d), got %s (%d)", EEXIST,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (tree_get_str_test) {
+  register unsigned int i;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node, *other;
+  const char *text;
+  char id[32];
+
+  mark_point();
+  text = sqlconf_tree_get_str(NULL, 0);
+  ck_assert_msg(text == NULL, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+
+  mark_point();
+  text = sqlconf_tree_get_str(tree, 1024);
+  ck_assert_msg(text == NULL, "Failed to handle unknown offset");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Each distinct string is stored once, whatever uses it. */
+  sqlconf_tree_add_ctx(tree, "1", NULL, "default", NULL);
+  for (i = 2; i <= 1000; i++) {
+    memset(id, '\0', sizeof(id));
+    snprintf(id, sizeof(id)-1, "%u", i);
+
+    sqlconf_tree_add_ctx(tree, id, "1", "Directory", i % 2 ? "/" : id);
+    sqlconf_tree_add_conf(tree, id, "Umask", "022");
+    sqlconf_tree_add_conf(tree, id, "AllowOverwrite", "on");
+  }
+
+  node = sqlconf_tree_get_ctx(tree, "2");
+  other = sqlconf_tree_get_ctx(tree, "999");
+  ck_assert_msg(node->type == other->type, "Expected shared type");
+  ck_assert_msg(node->value != other->value, "Expected distinct values");
+
+  text = sqlconf_tree_get_str(tree, other->value);
+  ck_assert_msg(strcmp(text, "/") == 0, "Expected '/', got '%s'", text);
+
+  other = sqlconf_tree_get_ctx(tree, "3");
+  ck_assert_msg(other->value == sqlconf_tree_get_ctx(tree, "999")->value,
+    "Expected shared value");
+
+  /* Offsets stay valid as the arena grows. */
+  text = sqlconf_tree_get_str(tree, node->value);
+  ck_assert_msg(strcmp(text, "2") == 0, "Expected '2', got '%s'", text);
+
+  node = sqlconf_tree_get_ctx(tree, "1000");
+  text = sqlconf_tree_get_str(tree, node->value);
+  ck_assert_msg(strcmp(text, "1000") == 0, "Expected '1000', got '%s'", text);
+}
+END_TEST
+
+START_TEST (tree_hash_test) {
+  int res;
+  uint64_t root_hash, dir_hash, global_hash;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node;
+
+  mark_point();
+  res = sqlconf_tree_hash(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+  sqlconf_tree_add_ctx(tree, "1", NULL, "default", NULL);
+  sqlconf_tree_add_ctx(tree, "2", "1", "Directory", "/");
+  sqlconf_tree_add_conf(tree, "2", "Umask", "022");
+  sqlconf_tree_add_ctx(tree, "3", "1", "Global", NULL);
+  sqlconf_tree_add_conf(tree, "3", "Umask", "022");
+  sqlconf_tree_link(tree);
+
+  mark_point();
+  res = sqlconf_tree_hash(tree);
+  ck_assert_msg(res == 0, "Failed to hash tree: %s", strerror(errno));
+
+  root_hash = sqlconf_tree_get_ctx(tree, "1")->hash;
+  dir_hash = sqlconf_tree_get_ctx(tree, "2")->hash;
+  global_hash = sqlconf_tree_get_ctx(tree, "3")->hash;
+  ck_assert_msg(dir_hash != global_hash,
+    "Expected different contexts to have different hashes");
+
+  /* Hashing again, without changes, yields the same hashes. */
+  sqlconf_tree_hash(tree);
+  ck_assert_msg(sqlconf_tree_get_ctx(tree, "1")->hash == root_hash,
+    "Expected unchanged root hash");
+
+  /* Changing a directive changes the hash of its context, and of every
+   * context above it, but not of its siblings.
+   */
+  sqlconf_tree_add_conf(tree, "2", "AllowOverwrite", "on");
+  sqlconf_tree_hash(tree);
+
+  node = sqlconf_tree_get_ctx(tree, "2");
+  ck_assert_msg(node->hash != dir_hash, "Expected changed context hash");
+  node = sqlconf_tree_get_ctx(tree, "1");
+  ck_assert_msg(node->hash != root_hash, "Expected changed root hash");
+  node = sqlconf_tree_get_ctx(tree, "3");
+  ck_assert_msg(node->hash == global_hash, "Expected unchanged sibling hash");
+}
+END_TEST
+
+START_TEST (tree_render_test) {
+  int res;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node;
+  sqlconf_buf_t *buf;
+  const char *text, *expected;
+
+  mark_point();
+  res = sqlconf_tree_render(NULL, NULL, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null tree");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  tree = sqlconf_tree_create(p);
+  sqlconf_tree_add_ctx(tree, "1", NULL, "default", NULL);
+  sqlconf_tree_add_conf(tree, "1", "ServerName", "\"foo\"");
+  sqlconf_tree_add_ctx(tree, "2", "1", "Directory", "/");
+  sqlconf_tree_add_ctx(tree, "3", "2", "Limit", "WRITE");
+  sqlconf_tree_add_conf(tree, "3", "DenyAll", "");
+  sqlconf_tree_add_ctx(tree, "4", "1", "Global", "");
+  sqlconf_tree_add_conf(tree, "4", "Umask", "022");
+  sqlconf_tree_link(tree);
+
+  buf = sqlconf_buf_create(p, 0);
+
+  mark_point();
+  res = sqlconf_tree_render(tree, NULL, 64, buf);
+  ck_assert_msg(res < 0, "Failed to handle null base");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  node = sqlconf_tree_get_root(tree);
+
+  mark_point();
+  res = sqlconf_tree_render(tree, node, 64, buf);
+  ck_assert_msg(res == 0, "Failed to render tree: %s", strerror(errno));
+
+  text = sqlconf_buf_get_text(buf, NULL);
+  expected = "ServerName \"foo\"\n"
+    "<Directory />\n"
+    "<Limit WRITE>\n"
+    "DenyAll \n"
+    "</Limit>\n"
+    "</Directory>\n"
+    "<Global>\n"
+    "Umask 022\n"
+    "</Global>\n";
+  ck_assert_msg(strcmp(text, expected) == 0, "Expected '%s', got '%s'",
+    expected, text);
+
+  /* Rendering from a nested base omits the base context's own tags. */
+  buf = sqlconf_buf_create(p, 0);
+  node = sqlconf_tree_get_ctx(tree, "2");
+
+  mark_point();
+  res = sqlconf_tree_render(tree, node, 64, buf);
+  ck_assert_msg(res == 0, "Failed to render tree: %s", strerror(errno));
+
+  text = sqlconf_buf_get_text(buf, NULL);
+  expected = "<Limit WRITE>\n"
+    "DenyAll \n"
+    "</Limit>\n";
+  ck_assert_msg(strcmp(text, expected) == 0, "Expected '%s', got '%s'",
+    expected, text);
+
+  /* Contexts nested too deeply are skipped. */
+  buf = sqlconf_buf_create(p, 0);
+  node = sqlconf_tree_get_root(tree);
+
+  mark_point();
+  res = sqlconf_tree_render(tree, node, 1, buf);
+  ck_assert_msg(res == 0, "Failed to render tree: %s", strerror(errno));
+
+  text = sqlconf_buf_get_text(buf, NULL);
+  expected = "ServerName \"foo\"\n"
+    "<Directory />\n"
+    "</Directory>\n"
+    "<Global>\n"
+    "Umask 022\n"
+    "</Global>\n";
+  ck_assert_msg(strcmp(text, expected) == 0, "Expected '%s', got '%s'",
+    expected, text);
+}
+END_TEST
+
+START_TEST (tree_large_test) {
+  register unsigned int i;
+  int res;
+  sqlconf_tree_t *tree;
+  sqlconf_node_t *node;
+  sqlconf_buf_t *buf;
+  const char *text, *expected;
+  size_t textlen;
+  char id[32], parent_id[32];
+
+  /* Enough contexts to grow the index, and the arrays, many times over. */
+  tree = sqlconf_tree_create(p);
+  sqlconf_tree_add_ctx(tree, "1", NULL, "default", NULL);
+
+  for (i = 2; i <= 100000; i++) {
+    memset(id, '\0', sizeof(id));
+    snprintf(id, sizeof(id)-1, "%u", i);
+    memset(parent_id, '\0', sizeof(parent_id));
+    snprintf(parent_id, sizeof(parent_id)-1, "%u", i % 2 == 0 ? 1 : i - 1);
+
+    res = sqlconf_tree_add_ctx(tree, id, parent_id, "Directory", id);
+    ck_assert_msg(res == 0, "Failed to add context %s: %s", id,
+      strerror(errno));
+
+    res = sqlconf_tree_add_conf(tree, id, "Umask", "022");
+    ck_assert_msg(res == 0, "Failed to add directive to %s: %s", id,
+      strerror(errno));
+  }
+
+  res = sqlconf_tree_link(tree);
+  ck_assert_msg(res == 0, "Failed to link tree: %s", strerror(errno));
+
+  for (i = 1; i <= 100000; i++) {
+    memset(id, '\0', sizeof(id));
+    snprintf(id, sizeof(id)-1, "%u", i);
+
+    node = sqlconf_tree_get_ctx(tree, id);
+    ck_assert_msg(node != NULL, "Failed to get context %s: %s", id,
+      strerror(errno));
+    ck_assert_msg(node->id == (int64_t) i, "Expected %u, got %lld", i,
+      (long long) node->id);
+  }
+
+  node = sqlconf_tree_get_root(tree);
+  ck_assert_msg(node != NULL, "Failed to get root: %s", strerror(errno));
+  ck_assert_msg(node->nchildren == 50000, "Expected 50000 children, got %u",
+    node->nchildren);
+
+  buf = sqlconf_buf_create(p, 0);
+
+  mark_point();
+  res = sqlconf_tree_render(tree, node, 64, buf);
+  ck_assert_msg(res == 0, "Failed to render tree: %s", strerror(errno));
+
+  /* Every context gets its tags and its directive. */
+  text = sqlconf_buf_get_text(buf, &textlen);
+  expected = "<Directory 2>\nUmask 022\n"
+    "<Directory 3>\nUmask 022\n</Directory>\n"
+    "</Directory>\n";
+  ck_assert_msg(strncmp(text, expected, strlen(expected)) == 0,
+    "Expected '%s', got '%.*s'", expected, (int) strlen(expected), text);
+  ck_assert_msg(strstr(text, "<Directory 100000>\nUmask 022\n"
+    "</Directory>\n") != NULL, "Missing last context");
+}
+END_TEST
+
+Suite *tests_get_tree_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("tree");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, tree_create_test);
+  tcase_add_test(testcase, tree_add_ctx_test);
+  tcase_add_test(testcase, tree_add_conf_test);
+  tcase_add_test(testcase, tree_render_confs_test);
+  tcase_add_test(testcase, tree_set_version_test);
+  tcase_add_test(testcase, tree_copy_ctx_test);
+  tcase_add_test(testcase, tree_link_test);
+  tcase_add_test(testcase, tree_get_str_test);
+  tcase_add_test(testcase, tree_hash_test);
+  tcase_add_test(testcase, tree_render_test);
+  tcase_add_test(testcase, tree_large_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -0,0 +1,468 @@
+/*
+ * ProFTPD - mod_conf_sql testsuite
+ * Copyright (c) 2016-2022 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Workers API tests. */
+
+#include "tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+static int item_cb(pool *item_pool, unsigned int item, const char *data,
+    sqlconf_buf_t *buf, void *user_data) {
+  char text[32];
+  int *fail_item;
+
+  fail_item = user_data;
+  if (fail_item != NULL &&
+      *fail_item == (int) item) {
+    errno = EPERM;
+    return -1;
+  }
+
+  /* Finish the items out of order. */
+  if (item % 3 == 0) {
+    usleep(2000);
+  }
+
+  memset(text, '\0', sizeof(text));
+  snprintf(text, sizeof(text)-1, "item %u\n", item);
+  sqlconf_buf_add(buf, text, NULL);
+  return 0;
+}
+
+static int echo_cb(pool *item_pool, unsigned int item, const char *data,
+    sqlconf_buf_t *buf, void *user_data) {
+  if (data != NULL &&
+      strcmp(data, "fail") == 0) {
+    errno = EPERM;
+    return -1;
+  }
+
+  sqlconf_buf_add(buf, data ? data : "", NULL);
+  return 0;
+}
+
+static int slow_cb(pool *item_pool, unsigned int item, const char *data,
+    sqlconf_buf_t *buf, void *user_data) {
+  /* Long enough that the test would notice being waited on. */
+  if (data != NULL &&
+      strcmp(data, "slow") == 0) {
+    sleep(30);
+  }
+
+  sqlconf_buf_add(buf, data ? data : "", NULL);
+  return 0;
+}
+
+/* Counts the items done by each worker process, e.g. to tell that state is
+ * kept by a worker from one item to the next.
+ */
+static int count_cb(pool *item_pool, unsigned int item, const char *data,
+    sqlconf_buf_t *buf, void *user_data) {
+  static unsigned int count = 0;
+  char text[32];
+
+  count++;
+
+  memset(text, '\0', sizeof(text));
+  snprintf(text, sizeof(text)-1, "%s %u", data ? data : "", count);
+  sqlconf_buf_add(buf, text, NULL);
+  return 0;
+}
+
+static const char *item_data(pool *data_pool, unsigned int item) {
+  char text[32];
+
+  memset(text, '\0', sizeof(text));
+  snprintf(text, sizeof(text)-1, "item %u", item);
+  return pstrdup(data_pool, text);
+}
+
+static int init_fail_cb(pool *worker_pool, unsigned int worker,
+    void *user_data) {
+  errno = EPERM;
+  return -1;
+}
+
+START_TEST (workers_run_test) {
+  register unsigned int i;
+  int res, fail_item;
+  sqlconf_buf_t *buf;
+  const char *text, *expected;
+  size_t textlen;
+
+  mark_point();
+  res = sqlconf_workers_run(NULL, 0, 0, NULL, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_workers_run(p, 0, 0, NULL, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle zero workers");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_workers_run(p, 2, 0, NULL, NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null callback");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_workers_run(p, 2, 0, NULL, item_cb, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null buffer");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  buf = sqlconf_buf_create(p, 0);
+
+  /* No items. */
+  mark_point();
+  res = sqlconf_workers_run(p, 2, 0, NULL, item_cb, NULL, NULL, buf);
+  ck_assert_msg(res == 0, "Failed to run no items: %s", strerror(errno));
+
+  /* Items are joined in item order, however many workers there are. */
+  expected = "";
+  for (i = 0; i < 20; i++) {
+    char line[32];
+
+    memset(line, '\0', sizeof(line));
+    snprintf(line, sizeof(line)-1, "item %u\n", i);
+    expected = pstrcat(p, expected, line, NULL);
+  }
+
+  for (i = 1; i <= 8; i++) {
+    sqlconf_buf_clear(buf);
+
+    mark_point();
+    res = sqlconf_workers_run(p, i, 20, NULL, item_cb, NULL, NULL, buf);
+    ck_assert_msg(res == 0, "Failed to run items with %u workers: %s", i,
+      strerror(errno));
+
+    text = sqlconf_buf_get_text(buf, &textlen);
+    ck_assert_msg(strcmp(text, expected) == 0,
+      "Expected '%s' with %u workers, got '%s'", expected, i, text);
+  }
+
+  /* A failed item fails the whole run, leaving the buffer alone. */
+  sqlconf_buf_clear(buf);
+  sqlconf_buf_add(buf, "base\n", NULL);
+  fail_item = 13;
+
+  mark_point();
+  res = sqlconf_workers_run(p, 4, 20, NULL, item_cb, NULL, &fail_item, buf);
+  ck_assert_msg(res < 0, "Failed to handle failed item");
+
+  text = sqlconf_buf_get_text(buf, &textlen);
+  ck_assert_msg(strcmp(text, "base\n") == 0, "Expected 'base\n', got '%s'",
+    text);
+
+  /* So does a worker which fails to start. */
+  mark_point();
+  res = sqlconf_workers_run(p, 4, 20, init_fail_cb, item_cb, NULL, NULL,
+    buf);
+  ck_assert_msg(res < 0, "Failed to handle failed worker");
+
+  text = sqlconf_buf_get_text(buf, &textlen);
+  ck_assert_msg(strcmp(text, "base\n") == 0, "Expected 'base\n', got '%s'",
+    text);
+}
+END_TEST
+
+START_TEST (workers_session_test) {
+  register unsigned int i;
+  int res;
+  sqlconf_workers_t *workers, *other;
+  unsigned int item, nseen = 0, nsubmitted = 0;
+  const char *text;
+  size_t textlen;
+  char seen[40];
+
+  mark_point();
+  workers = sqlconf_workers_start(NULL, 0, NULL, NULL, NULL, NULL);
+  ck_assert_msg(workers == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  workers = sqlconf_workers_start(p, 2, NULL, NULL, NULL, NULL);
+  ck_assert_msg(workers == NULL, "Failed to handle null callback");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_workers_submit(NULL, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null workers");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_workers_next(NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null workers");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = sqlconf_workers_stop(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null workers");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  workers = sqlconf_workers_start(p, 3, NULL, echo_cb, NULL, NULL);
+  ck_assert_msg(workers != NULL, "Failed to start workers: %s",
+    strerror(errno));
+
+  /* Nothing submitted, nothing outstanding. */
+  res = sqlconf_workers_next(workers, &item, &text, &textlen);
+  ck_assert_msg(res == 0, "Expected 0, got %d", res);
+
+  /* Submit half of the items up front, and the rest as results come in. */
+  memset(seen, '\0', sizeof(seen));
+  for (i = 0; i < 20; i++) {
+    res = sqlconf_workers_submit(workers, nsubmitted,
+      item_data(p, nsubmitted));
+    ck_assert_msg(res == 0, "Failed to submit item: %s", strerror(errno));
+    nsubmitted++;
+  }
+
+  while ((res = sqlconf_workers_next(workers, &item, &text, &textlen)) == 1) {
+    const char *expected;
+
+    ck_assert_msg(item < sizeof(seen), "Unexpected item %u", item);
+    ck_assert_msg(seen[item] == 0, "Item %u done twice", item);
+    seen[item] = 1;
+    nseen++;
+
+    expected = item_data(p, item);
+    ck_assert_msg(textlen == strlen(expected), "Expected length %lu, got %lu",
+      (unsigned long) strlen(expected), (unsigned long) textlen);
+    ck_assert_msg(strncmp(text, expected, textlen) == 0,
+      "Expected '%s', got '%.*s'", expected, (int) textlen, text);
+
+    if (nsubmitted < sizeof(seen)) {
+      res = sqlconf_workers_submit(workers, nsubmitted,
+        item_data(p, nsubmitted));
+      ck_assert_msg(res == 0, "Failed to submit item: %s", strerror(errno));
+      nsubmitted++;
+    }
+  }
+
+  ck_assert_msg(res == 0, "Failed to get next item: %s", strerror(errno));
+  ck_assert_msg(nseen == sizeof(seen), "Expected %lu items, got %u",
+    (unsigned long) sizeof(seen), nseen);
+
+  res = sqlconf_workers_stop(workers);
+  ck_assert_msg(res == 0, "Failed to stop workers: %s", strerror(errno));
+
+  /* Stopping one set of workers, while another is still running, must not
+   * wait on the other's workers.
+   */
+  mark_point();
+  workers = sqlconf_workers_start(p, 2, NULL, echo_cb, NULL, NULL);
+  ck_assert_msg(workers != NULL, "Failed to start workers: %s",
+    strerror(errno));
+
+  mark_point();
+  other = sqlconf_workers_start(p, 2, NULL, echo_cb, NULL, NULL);
+  ck_assert_msg(other != NULL, "Failed to start workers: %s",
+    strerror(errno));
+
+  res = sqlconf_workers_stop(workers);
+  ck_assert_msg(res == 0, "Failed to stop workers: %s", strerror(errno));
+
+  (void) sqlconf_workers_submit(other, 0, "other");
+  res = sqlconf_workers_next(other, &item, &text, &textlen);
+  ck_assert_msg(res == 1, "Failed to get next item: %s", strerror(errno));
+  ck_assert_msg(strncmp(text, "other", textlen) == 0,
+    "Expected 'other', got '%.*s'", (int) textlen, text);
+
+  res = sqlconf_workers_stop(other);
+  ck_assert_msg(res == 0, "Failed to stop workers: %s", strerror(errno));
+
+  /* A failed item fails the session. */
+  mark_point();
+  workers = sqlconf_workers_start(p, 2, NULL, echo_cb, NULL, NULL);
+  ck_assert_msg(workers != NULL, "Failed to start workers: %s",
+    strerror(errno));
+
+  (void) sqlconf_workers_submit(workers, 0, "ok");
+  (void) sqlconf_workers_submit(workers, 1, "fail");
+
+  while ((res = sqlconf_workers_next(workers, &item, &text, &textlen)) == 1) {
+  }
+  ck_assert_msg(res < 0, "Failed to handle failed item");
+
+  res = sqlconf_workers_stop(workers);
+  ck_assert_msg(res < 0, "Failed to handle failed workers");
+}
+END_TEST
+
+START_TEST (workers_timeout_test) {
+  int res;
+  sqlconf_workers_t *workers;
+  unsigned int item;
+  const char *text;
+  size_t textlen;
+  time_t started;
+
+  mark_point();
+  res = sqlconf_workers_set_timeout(NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null workers");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Items done in time are returned as usual. */
+  mark_point();
+  workers = sqlconf_workers_start(p, 1, NULL, slow_cb, NULL, NULL);
+  ck_assert_msg(workers != NULL, "Failed to start workers: %s",
+    strerror(errno));
+
+  res = sqlconf_workers_set_timeout(workers, 5000);
+  ck_assert_msg(res == 0, "Failed to set timeout: %s", strerror(errno));
+
+  (void) sqlconf_workers_submit(workers, 0, "fast");
+  res = sqlconf_workers_next(workers, &item, &text, &textlen);
+  ck_assert_msg(res == 1, "Failed to get next item: %s", strerror(errno));
+  ck_assert_msg(strncmp(text, "fast", textlen) == 0,
+    "Expected 'fast', got '%.*s'", (int) textlen, text);
+
+  res = sqlconf_workers_stop(workers);
+  ck_assert_msg(res == 0, "Failed to stop workers: %s", strerror(errno));
+
+  /* A worker still busy once the time has passed is not waited on. */
+  mark_point();
+  workers = sqlconf_workers_start(p, 1, NULL, slow_cb, NULL, NULL);
+  ck_assert_msg(workers != NULL, "Failed to start workers: %s",
+    strerror(errno));
+
+  started = time(NULL);
+  (void) sqlconf_workers_set_timeout(workers, 200);
+  (void) sqlconf_workers_submit(workers, 0, "slow");
+
+  res = sqlconf_workers_next(workers, &item, &text, &textlen);
+  ck_assert_msg(res < 0, "Failed to handle slow item");
+  ck_assert_msg(errno == ETIMEDOUT, "Expected ETIMEDOUT (%d), got %s (%d)",
+    ETIMEDOUT, strerror(errno), errno);
+
+  res = sqlconf_workers_stop(workers);
+  ck_assert_msg(res < 0, "Failed to handle expired workers");
+  ck_assert_msg(errno == ETIMEDOUT, "Expected ETIMEDOUT (%d), got %s (%d)",
+    ETIMEDOUT, strerror(errno), errno);
+  ck_assert_msg(time(NULL) - started < 10, "Waited on slow worker");
+}
+END_TEST
+
+START_TEST (workers_helper_test) {
+  register unsigned int i;
+  int res, status;
+  sqlconf_workers_t *workers;
+  unsigned int item;
+  const char *text;
+  size_t textlen;
+  time_t started;
+  pid_t pid;
+
+  /* A single worker, handed one item at a time, each within its own time
+   * limit, is the same process throughout, and so keeps its state.
+   */
+  mark_point();
+  workers = sqlconf_workers_start(p, 1, NULL, count_cb, NULL, NULL);
+  ck_assert_msg(workers != NULL, "Failed to start workers: %s",
+    strerror(errno));
+
+  for (i = 0; i < 3; i++) {
+    char expected[32];
+
+    res = sqlconf_workers_set_timeout(workers, 5000);
+    ck_assert_msg(res == 0, "Failed to set timeout: %s", strerror(errno));
+
+    res = sqlconf_workers_submit(workers, i, "uri");
+    ck_assert_msg(res == 0, "Failed to submit item: %s", strerror(errno));
+
+    res = sqlconf_workers_next(workers, &item, &text, &textlen);
+    ck_assert_msg(res == 1, "Failed to get next item: %s", strerror(errno));
+
+    memset(expected, '\0', sizeof(expected));
+    snprintf(expected, sizeof(expected)-1, "uri %u", i + 1);
+    ck_assert_msg(strncmp(text, expected, textlen) == 0,
+      "Expected '%s', got '%.*s'", expected, (int) textlen, text);
+  }
+
+  res = sqlconf_workers_next(workers, &item, &text, &textlen);
+  ck_assert_msg(res == 0, "Expected 0, got %d", res);
+
+  /* A process forked while the worker is idle, which detaches from it, must
+   * not keep the worker from seeing the end of its items.
+   */
+  pid = fork();
+  ck_assert_msg(pid >= 0, "Failed to fork: %s", strerror(errno));
+
+  if (pid == 0) {
+    sqlconf_workers_detach();
+    sleep(30);
+    _exit(0);
+  }
+
+  started = time(NULL);
+  res = sqlconf_workers_stop(workers);
+  ck_assert_msg(res == 0, "Failed to stop workers: %s", strerror(errno));
+  ck_assert_msg(time(NULL) - started < 10, "Waited on detached process");
+
+  (void) kill(pid, SIGKILL);
+  (void) waitpid(pid, &status, 0);
+}
+END_TEST
+
+Suite *tests_get_workers_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("workers");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, workers_run_test);
+  tcase_add_test(testcase, workers_session_test);
+  tcase_add_test(testcase, workers_timeout_test);
+  tcase_add_test(testcase, workers_helper_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
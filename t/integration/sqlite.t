@@ -6,7 +6,7 @@ use Carp;
 use Cwd qw(abs_path realpath);
 use File::Path qw(mkpath rmtree);
 use File::Spec;
-use Test::Simple tests => 8;
+use Test::Simple tests => 9;
 
 # Note: We COULD honor/use the TEST_VERBOSE environment variable here, but
 # this separate variable makes for a per-db verbose flag.
@@ -88,6 +88,13 @@ eval { $res = run_cmd($cmd, 1) };
 $ex = $@ if $@;
 ok($res && !defined($ex), "read valid config from complex SQLite URL");
 
+my $deadline_url = "$complex_url&strategy=bulk&deadline_ms=5000";
+$cmd = "$proftpd $proftpd_opts -c '$deadline_url'";
+$ex = undef;
+eval { $res = run_cmd($cmd, 1) };
+$ex = $@ if $@;
+ok($res && !defined($ex), "read valid config from SQLite URL with deadline");
+
 # XXX Last, empty/restore the db file, and populate it with BAD config
 
 sub run_cmd {
@@ -0,0 +1,893 @@
+/*
+ * ProFTPD - mod_conf_sql Tree implementation
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+#include "tree.h"
+
+/* A directive.  The directives of each context are chained by index, in row
+ * order.
+ */
+struct tree_conf {
+  size_t name;
+  size_t value;
+  int next;
+};
+
+struct sqlconf_tree {
+  pool *pool;
+
+  /* All nodes, in the order in which they were added. */
+  pool *nodes_pool;
+  sqlconf_node_t *nodes;
+  size_t nnodes, nodesz;
+
+  /* The directives of every context. */
+  pool *confs_pool;
+  struct tree_conf *confs;
+  size_t nconfs, confsz;
+
+  /* The arena holding every string of the tree; offset zero is reserved, to
+   * mean "none".  Each distinct string is stored once, however many
+   * contexts and directives use it.
+   */
+  pool *strs_pool;
+  char *strs;
+  size_t strslen, strssz;
+
+  /* Lookup of strings in the arena, using open addressing (with linear
+   * probing); each slot holds the offset of a string, or zero if empty.  The
+   * table is kept at most half full.
+   */
+  pool *str_index_pool;
+  size_t *str_index;
+  size_t str_indexsz, nstrs;
+
+  /* Lookup of nodes by ID, using open addressing (with linear probing); each
+   * slot holds the index of a node plus one, or zero if empty.  The table is
+   * kept at most half full.
+   */
+  pool *index_pool;
+  unsigned int *index;
+  size_t indexsz;
+
+  /* Toplevel contexts (int, node indices), i.e. those with no parent ID. */
+  array_header *roots;
+};
+
+static const char *trace_channel = "conf_sql";
+
+/* Grows the given flat array to hold at least the given number of elements.
+ * Each array is allocated from its own pool, so that the old array can be
+ * released as soon as it is copied; doubling the size keeps the number of
+ * copies small.
+ */
+static void *tree_grow(sqlconf_tree_t *tree, pool **elts_pool, void *elts,
+    size_t eltsz, size_t nelts, size_t *nalloc, size_t needed) {
+  size_t alloc;
+  pool *new_pool;
+  void *new_elts;
+
+  alloc = *nalloc > 0 ? *nalloc : 16;
+  while (alloc < needed) {
+    alloc *= 2;
+  }
+
+  new_pool = make_sub_pool(tree->pool);
+  pr_pool_tag(new_pool, "SQL Configuration Tree Pool");
+
+  new_elts = palloc(new_pool, alloc * eltsz);
+  if (nelts > 0) {
+    memcpy(new_elts, elts, nelts * eltsz);
+  }
+
+  if (*elts_pool != NULL) {
+    destroy_pool(*elts_pool);
+  }
+
+  *elts_pool = new_pool;
+  *nalloc = alloc;
+  return new_elts;
+}
+
+sqlconf_tree_t *sqlconf_tree_create(pool *p) {
+  sqlconf_tree_t *tree;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  tree = pcalloc(p, sizeof(sqlconf_tree_t));
+  tree->pool = p;
+  tree->roots = make_array(p, 1, sizeof(int));
+
+  tree->strs = tree_grow(tree, &(tree->strs_pool), NULL, 1, 0,
+    &(tree->strssz), 1024);
+  tree->strs[0] = '\0';
+  tree->strslen = 1;
+
+  return tree;
+}
+
+static int tree_parse_id(const char *text, int64_t *id) {
+  long long v;
+  char *ptr = NULL;
+
+  errno = 0;
+  v = strtoll(text, &ptr, 10);
+  if (errno == ERANGE ||
+      ptr == text ||
+      *ptr != '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *id = (int64_t) v;
+  return 0;
+}
+
+static size_t tree_hash_id(int64_t id, size_t indexsz) {
+  uint64_t h;
+
+  /* The finalizer of MurmurHash3, so that sequential IDs spread out. */
+  h = (uint64_t) id;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return (size_t) (h & (indexsz - 1));
+}
+
+/* Returns the index of the node with the given ID, or -1. */
+static int tree_find(sqlconf_tree_t *tree, int64_t id) {
+  size_t i;
+
+  if (tree->indexsz == 0) {
+    return -1;
+  }
+
+  for (i = tree_hash_id(id, tree->indexsz); tree->index[i] != 0;
+       i = (i + 1) & (tree->indexsz - 1)) {
+    int idx;
+
+    idx = (int) tree->index[i] - 1;
+    if (tree->nodes[idx].id == id) {
+      return idx;
+    }
+  }
+
+  return -1;
+}
+
+static void tree_index_node(sqlconf_tree_t *tree, int idx) {
+  size_t i;
+
+  i = tree_hash_id(tree->nodes[idx].id, tree->indexsz);
+  while (tree->index[i] != 0) {
+    i = (i + 1) & (tree->indexsz - 1);
+  }
+
+  tree->index[i] = (unsigned int) idx + 1;
+}
+
+/* Returns the index of the node with the given ID, adding the node if
+ * needed, or -1 on error.
+ */
+static int tree_get_idx(sqlconf_tree_t *tree, int64_t id) {
+  sqlconf_node_t *node;
+  int idx;
+
+  idx = tree_find(tree, id);
+  if (idx >= 0) {
+    return idx;
+  }
+
+  if (tree->nnodes >= (size_t) INT_MAX) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  if (tree->nnodes == tree->nodesz) {
+    tree->nodes = tree_grow(tree, &(tree->nodes_pool), tree->nodes,
+      sizeof(sqlconf_node_t), tree->nnodes, &(tree->nodesz),
+      tree->nnodes + 1);
+  }
+
+  if ((tree->nnodes + 1) * 2 > tree->indexsz) {
+    size_t i;
+
+    /* Rebuild the index, at twice the size. */
+    tree->indexsz = 0;
+    tree->index = tree_grow(tree, &(tree->index_pool), NULL,
+      sizeof(unsigned int), 0, &(tree->indexsz), (tree->nnodes + 1) * 2);
+    memset(tree->index, 0, tree->indexsz * sizeof(unsigned int));
+
+    for (i = 0; i < tree->nnodes; i++) {
+      tree_index_node(tree, (int) i);
+    }
+  }
+
+  idx = (int) tree->nnodes++;
+
+  node = &(tree->nodes[idx]);
+  memset(node, 0, sizeof(sqlconf_node_t));
+  node->id = id;
+  node->parent = node->first_child = node->last_child = -1;
+  node->next_sibling = node->first_conf = node->last_conf = -1;
+
+  tree_index_node(tree, idx);
+  return idx;
+}
+
+/* FNV-1a, over the given text and its terminating NUL, so that adjacent
+ * fields cannot run together.
+ */
+static uint64_t tree_hash_text(uint64_t hash, const char *text) {
+  const unsigned char *ptr;
+
+  ptr = (const unsigned char *) text;
+  do {
+    hash ^= *ptr;
+    hash *= 0x100000001b3ULL;
+  } while (*ptr++ != '\0');
+
+  return hash;
+}
+
+static size_t tree_hash_str(const char *text, size_t indexsz) {
+  uint64_t h;
+
+  h = tree_hash_text(0xcbf29ce484222325ULL, text);
+  return (size_t) (h & (indexsz - 1));
+}
+
+static void tree_index_str(sqlconf_tree_t *tree, size_t offset) {
+  size_t i;
+
+  i = tree_hash_str(tree->strs + offset, tree->str_indexsz);
+  while (tree->str_index[i] != 0) {
+    i = (i + 1) & (tree->str_indexsz - 1);
+  }
+
+  tree->str_index[i] = offset;
+}
+
+/* Returns the offset of the given string in the arena, copying it into the
+ * arena only if it is not already there.
+ */
+static size_t tree_add_str(sqlconf_tree_t *tree, const char *text) {
+  size_t i, len, offset;
+
+  if (tree->str_indexsz > 0) {
+    for (i = tree_hash_str(text, tree->str_indexsz); tree->str_index[i] != 0;
+         i = (i + 1) & (tree->str_indexsz - 1)) {
+      offset = tree->str_index[i];
+      if (strcmp(tree->strs + offset, text) == 0) {
+        return offset;
+      }
+    }
+  }
+
+  len = strlen(text);
+  if (tree->strslen + len + 1 > tree->strssz) {
+    tree->strs = tree_grow(tree, &(tree->strs_pool), tree->strs, 1,
+      tree->strslen, &(tree->strssz), tree->strslen + len + 1);
+  }
+
+  offset = tree->strslen;
+  memcpy(tree->strs + offset, text, len + 1);
+  tree->strslen += len + 1;
+
+  if ((tree->nstrs + 1) * 2 > tree->str_indexsz) {
+    size_t str_offset;
+
+    /* Rebuild the index, at twice the size, from the strings in the arena;
+     * each is stored once, so each is indexed once.
+     */
+    tree->str_indexsz = 0;
+    tree->str_index = tree_grow(tree, &(tree->str_index_pool), NULL,
+      sizeof(size_t), 0, &(tree->str_indexsz), (tree->nstrs + 1) * 2);
+    memset(tree->str_index, 0, tree->str_indexsz * sizeof(size_t));
+
+    for (str_offset = 1; str_offset < offset;
+         str_offset += strlen(tree->strs + str_offset) + 1) {
+      tree_index_str(tree, str_offset);
+    }
+  }
+
+  tree_index_str(tree, offset);
+  tree->nstrs++;
+
+  return offset;
+}
+
+/* As sqlconf_tree_get_str(), but "" for none, e.g. for rendering. */
+static const char *tree_str(sqlconf_tree_t *tree, size_t offset) {
+  return tree->strs + offset;
+}
+
+static int tree_add_ctx(sqlconf_tree_t *tree, int64_t id, int have_parent,
+    int64_t parent_id, const char *type, const char *value) {
+  sqlconf_node_t *node;
+  size_t type_offset, value_offset = 0;
+  int idx;
+
+  idx = tree_get_idx(tree, id);
+  if (idx < 0) {
+    return -1;
+  }
+
+  if (tree->nodes[idx].have_ctx == TRUE) {
+    pr_trace_msg(trace_channel, 3, "duplicate context ID %lld, ignoring",
+      (long long) id);
+    errno = EEXIST;
+    return -1;
+  }
+
+  type_offset = tree_add_str(tree, type);
+
+  /* Empty context values are treated as missing, e.g. "<Global>". */
+  if (value != NULL &&
+      *value != '\0') {
+    value_offset = tree_add_str(tree, value);
+  }
+
+  node = &(tree->nodes[idx]);
+  node->have_parent = have_parent;
+  node->parent_id = parent_id;
+  node->type = type_offset;
+  node->value = value_offset;
+  node->have_ctx = TRUE;
+
+  return 0;
+}
+
+int sqlconf_tree_add_ctx(sqlconf_tree_t *tree, const char *id,
+    const char *parent_id, const char *type, const char *value) {
+  int64_t ctx_id, ctx_parent_id = 0;
+  int have_parent = FALSE;
+
+  if (tree == NULL ||
+      id == NULL ||
+      *id == '\0' ||
+      type == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (tree_parse_id(id, &ctx_id) < 0) {
+    pr_trace_msg(trace_channel, 3, "invalid context ID '%s', ignoring", id);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (parent_id != NULL &&
+      *parent_id != '\0') {
+    if (tree_parse_id(parent_id, &ctx_parent_id) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "context ID %s has invalid parent ID '%s', ignoring", id, parent_id);
+      errno = EINVAL;
+      return -1;
+    }
+
+    have_parent = TRUE;
+  }
+
+  return tree_add_ctx(tree, ctx_id, have_parent, ctx_parent_id, type, value);
+}
+
+static int tree_add_conf(sqlconf_tree_t *tree, int64_t ctx_id,
+    const char *name, const char *value) {
+  sqlconf_node_t *node;
+  struct tree_conf *conf;
+  size_t name_offset, value_offset;
+  int idx, conf_idx;
+
+  idx = tree_get_idx(tree, ctx_id);
+  if (idx < 0) {
+    return -1;
+  }
+
+  if (tree->nconfs >= (size_t) INT_MAX) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  name_offset = tree_add_str(tree, name);
+  value_offset = tree_add_str(tree, value != NULL ? value : "");
+
+  if (tree->nconfs == tree->confsz) {
+    tree->confs = tree_grow(tree, &(tree->confs_pool), tree->confs,
+      sizeof(struct tree_conf), tree->nconfs, &(tree->confsz),
+      tree->nconfs + 1);
+  }
+
+  conf_idx = (int) tree->nconfs++;
+  conf = &(tree->confs[conf_idx]);
+  conf->name = name_offset;
+  conf->value = value_offset;
+  conf->next = -1;
+
+  node = &(tree->nodes[idx]);
+  if (node->last_conf >= 0) {
+    tree->confs[node->last_conf].next = conf_idx;
+
+  } else {
+    node->first_conf = conf_idx;
+  }
+
+  node->last_conf = conf_idx;
+  node->nconfs++;
+
+  return 0;
+}
+
+int sqlconf_tree_add_conf(sqlconf_tree_t *tree, const char *ctx_id,
+    const char *name, const char *value) {
+  int64_t id;
+
+  if (tree == NULL ||
+      ctx_id == NULL ||
+      *ctx_id == '\0' ||
+      name == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (tree_parse_id(ctx_id, &id) < 0) {
+    pr_trace_msg(trace_channel, 3, "invalid context ID '%s', ignoring",
+      ctx_id);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return tree_add_conf(tree, id, name, value);
+}
+
+static void tree_render_confs(sqlconf_tree_t *tree, sqlconf_node_t *node,
+    sqlconf_buf_t *buf) {
+  int i;
+
+  for (i = node->first_conf; i >= 0; i = tree->confs[i].next) {
+    sqlconf_buf_add(buf, tree_str(tree, tree->confs[i].name), " ",
+      tree_str(tree, tree->confs[i].value), "\n", NULL);
+  }
+}
+
+int sqlconf_tree_render_confs(sqlconf_tree_t *tree, const char *ctx_id,
+    sqlconf_buf_t *buf) {
+  int64_t id;
+  int idx;
+
+  if (tree == NULL ||
+      ctx_id == NULL ||
+      buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (tree_parse_id(ctx_id, &id) < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  idx = tree_find(tree, id);
+  if (idx < 0 ||
+      tree->nodes[idx].nconfs == 0) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  tree_render_confs(tree, &(tree->nodes[idx]), buf);
+  return 0;
+}
+
+int sqlconf_tree_set_version(sqlconf_tree_t *tree, const char *id,
+    const char *version) {
+  sqlconf_node_t *node;
+  size_t offset;
+
+  if (tree == NULL ||
+      id == NULL ||
+      version == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  node = sqlconf_tree_get_ctx(tree, id);
+  if (node == NULL) {
+    return -1;
+  }
+
+  /* Adding the string moves the arena, not the nodes. */
+  offset = tree_add_str(tree, version);
+  node->version = offset;
+  return 0;
+}
+
+int sqlconf_tree_copy_ctx(sqlconf_tree_t *tree, sqlconf_tree_t *src,
+    sqlconf_node_t *node) {
+  int i;
+
+  if (tree == NULL ||
+      src == NULL ||
+      node == NULL ||
+      node->have_ctx == FALSE ||
+      tree == src) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (tree_add_ctx(tree, node->id, node->have_parent, node->parent_id,
+      tree_str(src, node->type), tree_str(src, node->value)) < 0) {
+    return -1;
+  }
+
+  if (node->version != 0) {
+    size_t offset;
+    int idx;
+
+    offset = tree_add_str(tree, tree_str(src, node->version));
+    idx = tree_find(tree, node->id);
+    tree->nodes[idx].version = offset;
+  }
+
+  for (i = node->first_conf; i >= 0; i = src->confs[i].next) {
+    if (tree_add_conf(tree, node->id, tree_str(src, src->confs[i].name),
+        tree_str(src, src->confs[i].value)) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Whether following the parent IDs up from the given node leads back to
+ * that node.  Every step is bounded by the node count, so that a loop which
+ * does not include this node does not keep us here forever either.
+ */
+static int tree_is_loop(sqlconf_tree_t *tree, int idx) {
+  size_t i;
+  int ancestor;
+
+  ancestor = idx;
+  for (i = 0; i < tree->nnodes; i++) {
+    if (tree->nodes[ancestor].have_parent == FALSE) {
+      return FALSE;
+    }
+
+    ancestor = tree_find(tree, tree->nodes[ancestor].parent_id);
+    if (ancestor < 0 ||
+        tree->nodes[ancestor].have_ctx == FALSE) {
+      return FALSE;
+    }
+
+    if (ancestor == idx) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+int sqlconf_tree_link(sqlconf_tree_t *tree) {
+  size_t i;
+
+  if (tree == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Start from scratch, so that linking more than once is harmless. */
+  clear_array(tree->roots);
+
+  for (i = 0; i < tree->nnodes; i++) {
+    sqlconf_node_t *node;
+
+    node = &(tree->nodes[i]);
+    node->parent = node->first_child = node->last_child = -1;
+    node->next_sibling = -1;
+    node->nchildren = 0;
+  }
+
+  for (i = 0; i < tree->nnodes; i++) {
+    sqlconf_node_t *node, *parent;
+    int parent_idx;
+
+    node = &(tree->nodes[i]);
+    if (node->have_ctx == FALSE) {
+      continue;
+    }
+
+    if (node->have_parent == FALSE) {
+      *((int *) push_array(tree->roots)) = (int) i;
+      continue;
+    }
+
+    parent_idx = tree_find(tree, node->parent_id);
+    if (parent_idx < 0 ||
+        tree->nodes[parent_idx].have_ctx == FALSE) {
+      pr_trace_msg(trace_channel, 8,
+        "context ID %lld has unknown parent ID %lld, ignoring",
+        (long long) node->id, (long long) node->parent_id);
+      continue;
+    }
+
+    if (tree_is_loop(tree, (int) i) == TRUE) {
+      pr_trace_msg(trace_channel, 8,
+        "context ID %lld is nested within itself (loop of parent IDs), "
+        "ignoring", (long long) node->id);
+      continue;
+    }
+
+    parent = &(tree->nodes[parent_idx]);
+    if (parent->last_child >= 0) {
+      tree->nodes[parent->last_child].next_sibling = (int) i;
+
+    } else {
+      parent->first_child = (int) i;
+    }
+
+    parent->last_child = (int) i;
+    parent->nchildren++;
+    node->parent = parent_idx;
+  }
+
+  return 0;
+}
+
+sqlconf_node_t *sqlconf_tree_get_ctx(sqlconf_tree_t *tree, const char *id) {
+  int64_t ctx_id;
+  int idx;
+
+  if (tree == NULL ||
+      id == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (tree_parse_id(id, &ctx_id) < 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  idx = tree_find(tree, ctx_id);
+  if (idx < 0 ||
+      tree->nodes[idx].have_ctx == FALSE) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  return &(tree->nodes[idx]);
+}
+
+sqlconf_node_t *sqlconf_tree_get_node(sqlconf_tree_t *tree, int idx) {
+  if (tree == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (idx < 0 ||
+      (size_t) idx >= tree->nnodes) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  return &(tree->nodes[idx]);
+}
+
+sqlconf_node_t *sqlconf_tree_get_root(sqlconf_tree_t *tree) {
+  if (tree == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (tree->roots->nelts == 0) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  if (tree->roots->nelts > 1) {
+    errno = EEXIST;
+    return NULL;
+  }
+
+  return &(tree->nodes[((int *) tree->roots->elts)[0]]);
+}
+
+const char *sqlconf_tree_get_str(sqlconf_tree_t *tree, size_t offset) {
+  if (tree == NULL ||
+      offset >= tree->strslen) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (offset == 0) {
+    return NULL;
+  }
+
+  return tree->strs + offset;
+}
+
+/* Hashes the given node, whose children have already been hashed. */
+static void tree_hash_node(sqlconf_tree_t *tree, sqlconf_node_t *node) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  int i;
+
+  hash = tree_hash_text(hash, tree_str(tree, node->type));
+  hash = tree_hash_text(hash, tree_str(tree, node->value));
+
+  for (i = node->first_conf; i >= 0; i = tree->confs[i].next) {
+    hash = tree_hash_text(hash, tree_str(tree, tree->confs[i].name));
+    hash = tree_hash_text(hash, tree_str(tree, tree->confs[i].value));
+  }
+
+  for (i = node->first_child; i >= 0; i = tree->nodes[i].next_sibling) {
+    register unsigned int j;
+    uint64_t child_hash;
+
+    child_hash = tree->nodes[i].hash;
+    for (j = 0; j < sizeof(child_hash); j++) {
+      hash ^= (child_hash >> (j * 8)) & 0xff;
+      hash *= 0x100000001b3ULL;
+    }
+  }
+
+  node->hash = hash;
+}
+
+int sqlconf_tree_hash(sqlconf_tree_t *tree) {
+  register unsigned int i;
+  pool *tmp_pool;
+  array_header *order, *stack;
+  int *elts;
+
+  if (tree == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* List the linked nodes so that every node comes after its parent, then
+   * hash them in reverse, so that every node's children are hashed before
+   * the node itself.
+   */
+  tmp_pool = make_sub_pool(tree->pool);
+  order = make_array(tmp_pool, tree->nnodes + 1, sizeof(int));
+  stack = make_array(tmp_pool, 8, sizeof(int));
+  array_cat(stack, tree->roots);
+
+  while (stack->nelts > 0) {
+    int idx, child;
+
+    stack->nelts--;
+    idx = ((int *) stack->elts)[stack->nelts];
+    *((int *) push_array(order)) = idx;
+
+    for (child = tree->nodes[idx].first_child; child >= 0;
+         child = tree->nodes[child].next_sibling) {
+      *((int *) push_array(stack)) = child;
+    }
+  }
+
+  elts = order->elts;
+  for (i = order->nelts; i > 0; i--) {
+    tree_hash_node(tree, &(tree->nodes[elts[i-1]]));
+  }
+
+  destroy_pool(tmp_pool);
+  return 0;
+}
+
+/* Renders the opening tag (unless this is the base context) and the
+ * directives of the given node.
+ */
+static void tree_render_open(sqlconf_tree_t *tree, sqlconf_node_t *node,
+    sqlconf_buf_t *buf, int isbase) {
+  if (isbase == FALSE) {
+    sqlconf_buf_add(buf, "<", tree_str(tree, node->type),
+      node->value != 0 ? " " : "", tree_str(tree, node->value), ">\n", NULL);
+  }
+
+  tree_render_confs(tree, node, buf);
+}
+
+/* A frame of the render's explicit stack: the node, and its next child. */
+struct tree_render_frame {
+  int idx;
+  int next_child;
+  unsigned int depth;
+};
+
+int sqlconf_tree_render(sqlconf_tree_t *tree, sqlconf_node_t *base,
+    unsigned int max_depth, sqlconf_buf_t *buf) {
+  pool *tmp_pool;
+  array_header *stack;
+  struct tree_render_frame *frame;
+
+  if (tree == NULL ||
+      base == NULL ||
+      buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* The base context must be one of this tree's nodes. */
+  if (base < tree->nodes ||
+      base >= tree->nodes + tree->nnodes) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  tmp_pool = make_sub_pool(tree->pool);
+  stack = make_array(tmp_pool, 8, sizeof(struct tree_render_frame));
+
+  tree_render_open(tree, base, buf, TRUE);
+
+  frame = push_array(stack);
+  frame->idx = (int) (base - tree->nodes);
+  frame->next_child = base->first_child;
+  frame->depth = 0;
+
+  while (stack->nelts > 0) {
+    sqlconf_node_t *node;
+    unsigned int depth;
+    int child;
+
+    frame = &(((struct tree_render_frame *) stack->elts)[stack->nelts-1]);
+    child = frame->next_child;
+
+    if (child < 0) {
+      if (frame->depth > 0) {
+        sqlconf_buf_add(buf, "</",
+          tree_str(tree, tree->nodes[frame->idx].type), ">\n", NULL);
+      }
+
+      stack->nelts--;
+      continue;
+    }
+
+    node = &(tree->nodes[child]);
+    frame->next_child = node->next_sibling;
+    depth = frame->depth + 1;
+
+    if (depth > max_depth) {
+      pr_trace_msg(trace_channel, 8,
+        "context ID %lld nested more than %u contexts deep, skipping",
+        (long long) node->id, max_depth);
+      continue;
+    }
+
+    tree_render_open(tree, node, buf, FALSE);
+
+    frame = push_array(stack);
+    frame->idx = child;
+    frame->next_child = node->first_child;
+    frame->depth = depth;
+  }
+
+  destroy_pool(tmp_pool);
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * ProFTPD - mod_conf_sql Tree API
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+#include "buf.h"
+
+#ifndef MOD_CONF_SQL_TREE_H
+#define MOD_CONF_SQL_TREE_H
+
+/* A context, and the directives it contains, as read from the database.
+ *
+ * The nodes of a tree are kept in one flat array, and refer to each other by
+ * index; their strings are kept in one arena, shared by the whole tree, and
+ * referred to by offset (see sqlconf_tree_get_str()).  Each distinct string
+ * is stored once, so equal strings have equal offsets.  Pointers to nodes
+ * are thus only valid until the next context or directive is added.
+ */
+typedef struct sqlconf_node {
+  int64_t id;
+  int64_t parent_id;
+
+  /* Offsets of the context's strings in the arena; zero for none.  The
+   * version of the context row is only known if set (see
+   * sqlconf_tree_set_version()).
+   */
+  size_t type;
+  size_t value;
+  size_t version;
+
+  /* Hash of the context, its directives, and (recursively) its children; see
+   * sqlconf_tree_hash().
+   */
+  uint64_t hash;
+
+  /* Indices of the linked parent, and of the first/last child and the next
+   * sibling, in row order; -1 for none.
+   */
+  int parent;
+  int first_child;
+  int last_child;
+  int next_sibling;
+
+  /* Indices of the first/last directive, in row order; -1 for none. */
+  int first_conf;
+  int last_conf;
+
+  unsigned int nchildren;
+  unsigned int nconfs;
+
+  /* Set once the context row itself has been seen; directives may be added
+   * for a context ID before (or without) its row.
+   */
+  unsigned char have_ctx;
+  unsigned char have_parent;
+
+} sqlconf_node_t;
+
+typedef struct sqlconf_tree sqlconf_tree_t;
+
+sqlconf_tree_t *sqlconf_tree_create(pool *p);
+
+/* Adds the given context row to the tree.  Parent/child links are not made
+ * until sqlconf_tree_link() is called, so rows may be added in any order.
+ * An empty/NULL parent ID denotes a toplevel context.  IDs are integers;
+ * anything else is rejected with EINVAL.
+ */
+int sqlconf_tree_add_ctx(sqlconf_tree_t *tree, const char *id,
+  const char *parent_id, const char *type, const char *value);
+
+/* Appends the given directive to the list for the given context ID. */
+int sqlconf_tree_add_conf(sqlconf_tree_t *tree, const char *ctx_id,
+  const char *name, const char *value);
+
+/* Appends the directives for the given context ID, whether or not the
+ * context row itself has been added, as config file text to the given
+ * buffer.  Returns -1 (with ENOENT) if there are no directives for that
+ * context.
+ */
+int sqlconf_tree_render_confs(sqlconf_tree_t *tree, const char *ctx_id,
+  sqlconf_buf_t *buf);
+
+/* Records the version of the given context. */
+int sqlconf_tree_set_version(sqlconf_tree_t *tree, const char *id,
+  const char *version);
+
+/* Adds a copy of the given context row, its version, and its directives,
+ * from the given source tree, to the tree.  Children are not copied.
+ */
+int sqlconf_tree_copy_ctx(sqlconf_tree_t *tree, sqlconf_tree_t *src,
+  sqlconf_node_t *node);
+
+/* Links every added context to its parent.  Contexts whose parent was never
+ * added, or whose parent IDs loop back to themselves, are left unlinked, and
+ * thus never rendered.
+ */
+int sqlconf_tree_link(sqlconf_tree_t *tree);
+
+/* Returns the context with the given ID, or NULL (with ENOENT) if there is
+ * no such context row in the tree.
+ */
+sqlconf_node_t *sqlconf_tree_get_ctx(sqlconf_tree_t *tree, const char *id);
+
+/* Returns the node at the given index, e.g. a node's first child, or NULL
+ * (with ENOENT) if there is no such node.
+ */
+sqlconf_node_t *sqlconf_tree_get_node(sqlconf_tree_t *tree, int idx);
+
+/* Returns the single toplevel context.  Returns NULL with ENOENT if there
+ * is no such context, or with EEXIST if there is more than one.
+ */
+sqlconf_node_t *sqlconf_tree_get_root(sqlconf_tree_t *tree);
+
+/* Returns the string at the given offset in the tree's arena, or NULL for
+ * a zero offset.  The string is only valid until the next context or
+ * directive is added.
+ */
+const char *sqlconf_tree_get_str(sqlconf_tree_t *tree, size_t offset);
+
+/* Computes the hash of every linked context, such that a context's hash
+ * changes whenever it, its directives, or any context beneath it changes.
+ * The tree must already be linked.
+ */
+int sqlconf_tree_hash(sqlconf_tree_t *tree);
+
+/* Renders the given base context, and everything beneath it (down to the
+ * given depth), as config file text appended to the given buffer.  The
+ * opening/closing tags of the base context itself are not rendered.
+ */
+int sqlconf_tree_render(sqlconf_tree_t *tree, sqlconf_node_t *base,
+  unsigned int max_depth, sqlconf_buf_t *buf);
+
+#endif /* MOD_CONF_SQL_TREE_H */
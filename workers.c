@@ -0,0 +1,740 @@
+/*
+ * ProFTPD - mod_conf_sql Workers implementation
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+#include "workers.h"
+
+#include <poll.h>
+
+/* Workers are processes, rather than threads: neither the pool API nor the
+ * mod_sql backends are thread-safe.  Each worker has two pipes: one on which
+ * it is sent the items to run (each item's number, and its data), and one on
+ * which it sends back the text of each item, as a header followed by the
+ * text itself.
+ */
+struct workers_cmd {
+  uint32_t item;
+  uint32_t datalen;
+};
+
+struct workers_msg {
+  uint32_t item;
+  int32_t status;
+  uint32_t textlen;
+};
+
+struct worker {
+  pid_t pid;
+
+  /* The parent's ends of the worker's pipes. */
+  int cmd_fd;
+  int res_fd;
+
+  /* The number of items sent to the worker but not yet returned. */
+  unsigned int pending;
+};
+
+/* An item submitted, but not yet sent to any worker. */
+struct workers_item {
+  unsigned int item;
+  const char *data;
+};
+
+struct sqlconf_workers {
+  pool *pool;
+
+  struct worker *workers;
+  unsigned int nworkers;
+  struct pollfd *pfds;
+
+  /* Items not yet sent to a worker (struct workers_item), oldest first. */
+  array_header *queue;
+  unsigned int next_queued;
+
+  /* The text of the last item returned. */
+  char *text;
+  size_t textlen, textsz;
+
+  int failed;
+  void (*prev_sigpipe)(int);
+
+  /* When the workers must be done by, if set (see
+   * sqlconf_workers_set_timeout()), and whether that time has passed.
+   */
+  int have_timeout;
+  struct timeval expires;
+  int expired;
+
+  /* The other sets of workers running at the same time, e.g. for nested
+   * Includes.
+   */
+  sqlconf_workers_t *next;
+};
+
+/* How many items each worker is sent ahead, so that it need not wait on
+ * the parent between items.
+ */
+#define CONF_SQL_WORKERS_QUEUE_DEPTH	2
+
+static const char *trace_channel = "conf_sql";
+
+/* Every set of workers currently running. */
+static sqlconf_workers_t *workers_running = NULL;
+
+static int workers_read_all(int fd, void *data, size_t datalen) {
+  char *ptr;
+  size_t nread = 0;
+
+  ptr = data;
+  while (nread < datalen) {
+    ssize_t res;
+
+    res = read(fd, ptr + nread, datalen - nread);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return -1;
+    }
+
+    if (res == 0) {
+      /* EOF before anything was read is a clean end; partway through is
+       * not.
+       */
+      if (nread == 0) {
+        return 0;
+      }
+
+      errno = EPIPE;
+      return -1;
+    }
+
+    nread += res;
+  }
+
+  return 1;
+}
+
+static int workers_write_all(int fd, const void *data, size_t datalen) {
+  const char *ptr;
+
+  ptr = data;
+  while (datalen > 0) {
+    ssize_t res;
+
+    res = write(fd, ptr, datalen);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return -1;
+    }
+
+    ptr += res;
+    datalen -= res;
+  }
+
+  return 0;
+}
+
+static void workers_child(pool *p, unsigned int worker, int cmd_fd,
+    int res_fd, sqlconf_workers_init_cb init_cb,
+    sqlconf_workers_item_cb item_cb, sqlconf_workers_exit_cb exit_cb,
+    void *user_data) {
+  sqlconf_buf_t *buf;
+  struct workers_cmd cmd;
+
+  if (init_cb != NULL &&
+      init_cb(p, worker, user_data) < 0) {
+    pr_trace_msg(trace_channel, 3, "worker %u failed to start: %s", worker,
+      strerror(errno));
+    _exit(1);
+  }
+
+  buf = sqlconf_buf_create(p, 0);
+
+  while (workers_read_all(cmd_fd, &cmd, sizeof(cmd)) == 1) {
+    struct workers_msg msg;
+    const char *text;
+    char *data = NULL;
+    size_t textlen = 0;
+    pool *item_pool;
+
+    item_pool = make_sub_pool(p);
+
+    if (cmd.datalen > 0) {
+      data = pcalloc(item_pool, cmd.datalen + 1);
+      if (workers_read_all(cmd_fd, data, cmd.datalen) != 1) {
+        break;
+      }
+    }
+
+    sqlconf_buf_clear(buf);
+
+    msg.item = cmd.item;
+    msg.status = 0;
+
+    if (item_cb(item_pool, cmd.item, data, buf, user_data) < 0) {
+      msg.status = -1;
+    }
+
+    text = sqlconf_buf_get_text(buf, &textlen);
+    if (msg.status < 0) {
+      textlen = 0;
+    }
+
+    msg.textlen = (uint32_t) textlen;
+
+    if (workers_write_all(res_fd, &msg, sizeof(msg)) < 0 ||
+        workers_write_all(res_fd, text, textlen) < 0) {
+      break;
+    }
+
+    destroy_pool(item_pool);
+  }
+
+  if (exit_cb != NULL) {
+    exit_cb(p, worker, user_data);
+  }
+
+  /* Exit without running any of the parent's exit handlers, which would,
+   * for example, close the parent's database connections.
+   */
+  _exit(0);
+}
+
+/* Closes the parent's ends of the pipes of every worker started so far, in
+ * every set of workers; otherwise, those workers would never see the end of
+ * their items.
+ */
+static void workers_close_parent_fds(void) {
+  sqlconf_workers_t *workers;
+
+  for (workers = workers_running; workers != NULL; workers = workers->next) {
+    register unsigned int i;
+
+    for (i = 0; i < workers->nworkers; i++) {
+      if (workers->workers[i].cmd_fd >= 0) {
+        (void) close(workers->workers[i].cmd_fd);
+      }
+
+      if (workers->workers[i].res_fd >= 0) {
+        (void) close(workers->workers[i].res_fd);
+      }
+    }
+  }
+}
+
+/* Sends queued items to any worker with room for more. */
+static int workers_send_items(sqlconf_workers_t *workers) {
+  register unsigned int i;
+  struct workers_item *items;
+
+  items = workers->queue->elts;
+
+  for (i = 0; i < workers->nworkers; i++) {
+    struct worker *w;
+
+    w = &(workers->workers[i]);
+    while (w->pending < CONF_SQL_WORKERS_QUEUE_DEPTH &&
+           workers->next_queued < workers->queue->nelts) {
+      struct workers_item *item;
+      struct workers_cmd cmd;
+
+      item = &(items[workers->next_queued]);
+      cmd.item = (uint32_t) item->item;
+      cmd.datalen = item->data ? (uint32_t) strlen(item->data) : 0;
+
+      if (workers_write_all(w->cmd_fd, &cmd, sizeof(cmd)) < 0 ||
+          workers_write_all(w->cmd_fd, item->data, cmd.datalen) < 0) {
+        return -1;
+      }
+
+      w->pending++;
+      workers->next_queued++;
+    }
+  }
+
+  /* Once every queued item has been sent, reuse the queue. */
+  if (workers->next_queued == workers->queue->nelts) {
+    clear_array(workers->queue);
+    workers->next_queued = 0;
+  }
+
+  return 0;
+}
+
+/* Reads one item's text back from the given worker. */
+static int workers_recv_item(sqlconf_workers_t *workers, struct worker *w,
+    unsigned int *item) {
+  struct workers_msg msg;
+  int res;
+
+  res = workers_read_all(w->res_fd, &msg, sizeof(msg));
+  if (res <= 0) {
+    pr_trace_msg(trace_channel, 3, "worker (PID %lu) exited early",
+      (unsigned long) w->pid);
+    errno = EPIPE;
+    return -1;
+  }
+
+  if (msg.status < 0) {
+    pr_trace_msg(trace_channel, 3, "worker (PID %lu) failed item %lu",
+      (unsigned long) w->pid, (unsigned long) msg.item);
+    errno = EIO;
+    return -1;
+  }
+
+  if (msg.textlen + 1 > workers->textsz) {
+    workers->textsz = msg.textlen + 1;
+    workers->text = palloc(workers->pool, workers->textsz);
+  }
+
+  if (msg.textlen > 0 &&
+      workers_read_all(w->res_fd, workers->text, msg.textlen) != 1) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  workers->text[msg.textlen] = '\0';
+  workers->textlen = msg.textlen;
+  w->pending--;
+
+  *item = msg.item;
+  return 0;
+}
+
+sqlconf_workers_t *sqlconf_workers_start(pool *p, unsigned int nworkers,
+    sqlconf_workers_init_cb init_cb, sqlconf_workers_item_cb item_cb,
+    sqlconf_workers_exit_cb exit_cb, void *user_data) {
+  register unsigned int i;
+  sqlconf_workers_t *workers;
+  pool *workers_pool;
+
+  if (p == NULL ||
+      nworkers == 0 ||
+      item_cb == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (nworkers > CONF_SQL_WORKERS_MAX_COUNT) {
+    nworkers = CONF_SQL_WORKERS_MAX_COUNT;
+  }
+
+  workers_pool = make_sub_pool(p);
+  pr_pool_tag(workers_pool, "SQL Configuration Workers Pool");
+
+  workers = pcalloc(workers_pool, sizeof(sqlconf_workers_t));
+  workers->pool = workers_pool;
+  workers->workers = pcalloc(workers_pool, nworkers * sizeof(struct worker));
+  workers->pfds = pcalloc(workers_pool, nworkers * sizeof(struct pollfd));
+  workers->queue = make_array(workers_pool, 16, sizeof(struct workers_item));
+
+  for (i = 0; i < nworkers; i++) {
+    workers->workers[i].pid = -1;
+    workers->workers[i].cmd_fd = workers->workers[i].res_fd = -1;
+  }
+
+  /* A worker exiting early must not take the parent down with it. */
+  workers->prev_sigpipe = signal(SIGPIPE, SIG_IGN);
+
+  workers->next = workers_running;
+  workers_running = workers;
+
+  for (i = 0; i < nworkers; i++) {
+    int cmd_fds[2], res_fds[2], xerrno;
+    pid_t pid;
+
+    if (pipe(cmd_fds) < 0) {
+      xerrno = errno;
+
+      workers->failed = TRUE;
+      (void) sqlconf_workers_stop(workers);
+      errno = xerrno;
+      return NULL;
+    }
+
+    if (pipe(res_fds) < 0) {
+      xerrno = errno;
+
+      (void) close(cmd_fds[0]);
+      (void) close(cmd_fds[1]);
+      workers->failed = TRUE;
+      (void) sqlconf_workers_stop(workers);
+      errno = xerrno;
+      return NULL;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+      xerrno = errno;
+
+      (void) close(cmd_fds[0]);
+      (void) close(cmd_fds[1]);
+      (void) close(res_fds[0]);
+      (void) close(res_fds[1]);
+      workers->failed = TRUE;
+      (void) sqlconf_workers_stop(workers);
+      errno = xerrno;
+      return NULL;
+    }
+
+    if (pid == 0) {
+      workers_close_parent_fds();
+
+      (void) close(cmd_fds[1]);
+      (void) close(res_fds[0]);
+
+      workers_child(workers_pool, i, cmd_fds[0], res_fds[1], init_cb,
+        item_cb, exit_cb, user_data);
+    }
+
+    (void) close(cmd_fds[0]);
+    (void) close(res_fds[1]);
+
+    workers->workers[i].pid = pid;
+    workers->workers[i].cmd_fd = cmd_fds[1];
+    workers->workers[i].res_fd = res_fds[0];
+    workers->nworkers++;
+  }
+
+  pr_trace_msg(trace_channel, 8, "started %u workers", workers->nworkers);
+  return workers;
+}
+
+int sqlconf_workers_submit(sqlconf_workers_t *workers, unsigned int item,
+    const char *data) {
+  struct workers_item *queued;
+
+  if (workers == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (workers->failed == TRUE) {
+    errno = EPERM;
+    return -1;
+  }
+
+  queued = push_array(workers->queue);
+  queued->item = item;
+  queued->data = data ? pstrdup(workers->pool, data) : NULL;
+
+  /* Send the item now, if any worker has room for it, so that the worker
+   * can start on it while the caller does other work.
+   */
+  if (workers_send_items(workers) < 0) {
+    workers->failed = TRUE;
+    return -1;
+  }
+
+  return 0;
+}
+
+int sqlconf_workers_set_timeout(sqlconf_workers_t *workers,
+    unsigned int timeout_ms) {
+  if (workers == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  gettimeofday(&(workers->expires), NULL);
+  workers->expires.tv_sec += timeout_ms / 1000;
+  workers->expires.tv_usec += (timeout_ms % 1000) * 1000;
+  if (workers->expires.tv_usec >= 1000000) {
+    workers->expires.tv_sec++;
+    workers->expires.tv_usec -= 1000000;
+  }
+
+  workers->have_timeout = TRUE;
+  return 0;
+}
+
+/* Returns the number of milliseconds to wait on the workers, or -1 for no
+ * limit; zero means the time has passed.
+ */
+static int workers_get_timeout(sqlconf_workers_t *workers) {
+  struct timeval now;
+  long remaining;
+
+  if (workers->have_timeout == FALSE) {
+    return -1;
+  }
+
+  gettimeofday(&now, NULL);
+  remaining = ((workers->expires.tv_sec - now.tv_sec) * 1000L) +
+    ((workers->expires.tv_usec - now.tv_usec + 999) / 1000L);
+  if (remaining <= 0) {
+    return 0;
+  }
+
+  return remaining > INT_MAX ? INT_MAX : (int) remaining;
+}
+
+int sqlconf_workers_next(sqlconf_workers_t *workers, unsigned int *item,
+    const char **text, size_t *textlen) {
+  register unsigned int i;
+
+  if (workers == NULL ||
+      item == NULL ||
+      text == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (workers->failed == TRUE) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (workers_send_items(workers) < 0) {
+    workers->failed = TRUE;
+    return -1;
+  }
+
+  while (TRUE) {
+    unsigned int npfds = 0;
+    int res, timeout;
+
+    for (i = 0; i < workers->nworkers; i++) {
+      struct worker *w;
+
+      w = &(workers->workers[i]);
+      workers->pfds[i].fd = w->pending > 0 ? w->res_fd : -1;
+      workers->pfds[i].events = POLLIN;
+      workers->pfds[i].revents = 0;
+
+      if (workers->pfds[i].fd >= 0) {
+        npfds++;
+      }
+    }
+
+    if (npfds == 0) {
+      /* Nothing left outstanding. */
+      return 0;
+    }
+
+    timeout = workers_get_timeout(workers);
+    if (timeout == 0) {
+      pr_trace_msg(trace_channel, 3, "workers did not finish in time");
+      workers->failed = workers->expired = TRUE;
+      errno = ETIMEDOUT;
+      return -1;
+    }
+
+    res = poll(workers->pfds, workers->nworkers, timeout);
+    if (res < 0) {
+      if (errno == EINTR) {
+        pr_signals_handle();
+        continue;
+      }
+
+      workers->failed = TRUE;
+      return -1;
+    }
+
+    for (i = 0; i < workers->nworkers; i++) {
+      if (workers->pfds[i].fd < 0 ||
+          workers->pfds[i].revents == 0) {
+        continue;
+      }
+
+      if (workers_recv_item(workers, &(workers->workers[i]), item) < 0 ||
+          workers_send_items(workers) < 0) {
+        workers->failed = TRUE;
+        return -1;
+      }
+
+      *text = workers->text;
+      if (textlen != NULL) {
+        *textlen = workers->textlen;
+      }
+
+      return 1;
+    }
+  }
+}
+
+int sqlconf_workers_stop(sqlconf_workers_t *workers) {
+  register unsigned int i;
+  int failed, expired;
+
+  if (workers == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (workers_running == workers) {
+    workers_running = workers->next;
+
+  } else {
+    sqlconf_workers_t *prev;
+
+    for (prev = workers_running; prev != NULL; prev = prev->next) {
+      if (prev->next == workers) {
+        prev->next = workers->next;
+        break;
+      }
+    }
+  }
+
+  /* Closing the command pipes tells each worker to exit once it has sent
+   * back the items it was given; a failed run does not wait for those.
+   * Workers which ran out of time may be blocked, e.g. connecting to an
+   * unreachable database, and so are killed outright.
+   */
+  for (i = 0; i < workers->nworkers; i++) {
+    struct worker *w;
+
+    w = &(workers->workers[i]);
+
+    if (w->cmd_fd >= 0) {
+      (void) close(w->cmd_fd);
+      w->cmd_fd = -1;
+    }
+
+    if (w->res_fd >= 0) {
+      (void) close(w->res_fd);
+      w->res_fd = -1;
+    }
+
+    if (workers->failed == TRUE &&
+        w->pid > 0) {
+      (void) kill(w->pid, workers->expired == TRUE ? SIGKILL : SIGTERM);
+    }
+  }
+
+  for (i = 0; i < workers->nworkers; i++) {
+    struct worker *w;
+    int status;
+
+    w = &(workers->workers[i]);
+    if (w->pid <= 0) {
+      continue;
+    }
+
+    while (waitpid(w->pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+        break;
+      }
+    }
+  }
+
+  (void) signal(SIGPIPE, workers->prev_sigpipe);
+
+  failed = workers->failed;
+  expired = workers->expired;
+  destroy_pool(workers->pool);
+
+  if (failed == TRUE) {
+    errno = expired == TRUE ? ETIMEDOUT : EIO;
+    return -1;
+  }
+
+  return 0;
+}
+
+void sqlconf_workers_detach(void) {
+  workers_close_parent_fds();
+  workers_running = NULL;
+}
+
+int sqlconf_workers_run(pool *p, unsigned int nworkers, unsigned int nitems,
+    sqlconf_workers_init_cb init_cb, sqlconf_workers_item_cb item_cb,
+    sqlconf_workers_exit_cb exit_cb, void *user_data, sqlconf_buf_t *buf) {
+  register unsigned int i;
+  sqlconf_workers_t *workers;
+  char **texts;
+  unsigned int item, ndone = 0;
+  const char *text;
+  size_t textlen;
+  pool *tmp_pool;
+  int res, xerrno;
+
+  if (p == NULL ||
+      nworkers == 0 ||
+      item_cb == NULL ||
+      buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (nitems == 0) {
+    return 0;
+  }
+
+  if (nworkers > nitems) {
+    nworkers = nitems;
+  }
+
+  workers = sqlconf_workers_start(p, nworkers, init_cb, item_cb, exit_cb,
+    user_data);
+  if (workers == NULL) {
+    return -1;
+  }
+
+  tmp_pool = make_sub_pool(p);
+  texts = pcalloc(tmp_pool, nitems * sizeof(char *));
+
+  for (i = 0; i < nitems; i++) {
+    (void) sqlconf_workers_submit(workers, i, NULL);
+  }
+
+  while ((res = sqlconf_workers_next(workers, &item, &text, &textlen)) == 1) {
+    if (item >= nitems ||
+        texts[item] != NULL) {
+      pr_trace_msg(trace_channel, 3, "worker sent unexpected item %u", item);
+      errno = EINVAL;
+      res = -1;
+      break;
+    }
+
+    texts[item] = pstrndup(tmp_pool, text, textlen);
+    ndone++;
+  }
+
+  xerrno = errno;
+
+  if (res < 0) {
+    workers->failed = TRUE;
+  }
+
+  if (sqlconf_workers_stop(workers) < 0 ||
+      ndone < nitems) {
+    pr_trace_msg(trace_channel, 3, "workers failed: %s", strerror(xerrno));
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  for (i = 0; i < nitems; i++) {
+    sqlconf_buf_add(buf, texts[i], NULL);
+  }
+
+  destroy_pool(tmp_pool);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * ProFTPD - mod_conf_sql Workers API
+ * Copyright (c) 2016 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_conf_sql.h"
+#include "buf.h"
+
+#ifndef MOD_CONF_SQL_WORKERS_H
+#define MOD_CONF_SQL_WORKERS_H
+
+/* Called once in each worker process, before it is handed any items, e.g.
+ * to open the worker's own database connection.
+ */
+typedef int (*sqlconf_workers_init_cb)(pool *p, unsigned int worker,
+  void *user_data);
+
+/* Called in a worker process for each item it is handed, with that item's
+ * data (if any); the text for that item is appended to the given buffer.
+ */
+typedef int (*sqlconf_workers_item_cb)(pool *p, unsigned int item,
+  const char *data, sqlconf_buf_t *buf, void *user_data);
+
+/* Called once in each worker process, after its last item, e.g. to close
+ * the worker's database connection.
+ */
+typedef void (*sqlconf_workers_exit_cb)(pool *p, unsigned int worker,
+  void *user_data);
+
+/* Runs the items, numbered from zero, across the given number of worker
+ * processes, handing each worker its next item as it finishes the last.
+ * The text of every item is then appended to the given buffer, in item
+ * order.  Returns -1 (and appends nothing) if any item fails, or any worker
+ * exits early.
+ */
+int sqlconf_workers_run(pool *p, unsigned int nworkers, unsigned int nitems,
+  sqlconf_workers_init_cb init_cb, sqlconf_workers_item_cb item_cb,
+  sqlconf_workers_exit_cb exit_cb, void *user_data, sqlconf_buf_t *buf);
+#define CONF_SQL_WORKERS_MAX_COUNT		64
+
+/* For handing out items as they are found, rather than all up front. */
+typedef struct sqlconf_workers sqlconf_workers_t;
+
+/* Starts the given number of worker processes. */
+sqlconf_workers_t *sqlconf_workers_start(pool *p, unsigned int nworkers,
+  sqlconf_workers_init_cb init_cb, sqlconf_workers_item_cb item_cb,
+  sqlconf_workers_exit_cb exit_cb, void *user_data);
+
+/* Queues the given item, with its (optional) data, for the next worker with
+ * room for it; the item is sent straight away if a worker has room now.
+ */
+int sqlconf_workers_submit(sqlconf_workers_t *workers, unsigned int item,
+  const char *data);
+
+/* Limits how long the workers may take, in total, to the given number of
+ * milliseconds from now.  Once that time has passed, sqlconf_workers_next()
+ * returns -1 (with ETIMEDOUT), and sqlconf_workers_stop() kills the workers
+ * rather than waiting on them.
+ */
+int sqlconf_workers_set_timeout(sqlconf_workers_t *workers,
+  unsigned int timeout_ms);
+
+/* Waits for the next item to be done, by any worker, and returns 1 with that
+ * item's number and text; the text is only valid until the next call.
+ * Returns 0 once every submitted item is done, or -1 if an item fails, or a
+ * worker exits early.
+ */
+int sqlconf_workers_next(sqlconf_workers_t *workers, unsigned int *item,
+  const char **text, size_t *textlen);
+
+/* Stops the workers, waiting for them to exit, and frees them.  Returns -1
+ * if the workers had failed.
+ */
+int sqlconf_workers_stop(sqlconf_workers_t *workers);
+
+/* For a process forked other than by this API: closes its copies of the
+ * parent's ends of the pipes of every set of workers running, which it does
+ * not use, so that those workers still see the end of their items once the
+ * parent stops them.
+ */
+void sqlconf_workers_detach(void);
+
+#endif /* MOD_CONF_SQL_WORKERS_H */